@@ -0,0 +1,67 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+
+#include "arena.h"
+
+// Smallest amount of memory obtained from the system at once.
+static const size_t CHUNK_SIZE = 1 << 20;
+
+void arena::add_chunk(size_t bytes) {
+    size_t size = std::max(bytes, CHUNK_SIZE);
+    // Grow geometrically, such that a map without a size hint still needs few chunks.
+    if (!chunks.empty()) size = std::max(size, chunks.back().size * 2);
+    chunk c = {(char*)malloc(size), size, 0};
+    if (!c.data) throw std::bad_alloc();
+    chunks.push_back(c);
+    total += size;
+}
+
+void arena::reserve(size_t bytes) {
+    if (!chunks.empty() && chunks.back().size - chunks.back().used >= bytes) return;
+    add_chunk(bytes);
+}
+
+void * arena::allocate(size_t bytes, size_t alignment) {
+    if (bytes == 0) return NULL;
+    if (!chunks.empty()) {
+        chunk & c = chunks.back();
+        size_t start = (c.used + alignment - 1) / alignment * alignment;
+        if (start + bytes <= c.size) {
+            c.used = start + bytes;
+            used += bytes;
+            return c.data + start;
+        }
+    }
+    // malloc aligns to max_align_t, which is enough for everything stored in the arena.
+    add_chunk(bytes);
+    chunk & c = chunks.back();
+    c.used = bytes;
+    used += bytes;
+    return c.data;
+}
+
+void arena::reset() {
+    for (const chunk & c : chunks) free(c.data);
+    chunks.clear();
+    used = 0;
+    total = 0;
+}
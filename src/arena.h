@@ -0,0 +1,87 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Memory that lives as long as the map that is loaded. Allocation only bumps a pointer,
+ * and all memory is freed at once when the map is unloaded.
+ */
+class arena {
+public:
+    arena() : used(0), total(0) {}
+    ~arena() {reset();}
+    /** Makes sure that the given number of bytes can be allocated without obtaining more memory. */
+    void reserve(size_t bytes);
+    void * allocate(size_t bytes, size_t alignment);
+    /** Frees all memory. Anything allocated from the arena must no longer be used. */
+    void reset();
+    /** Number of bytes allocated since the last reset. */
+    size_t allocated() const {return used;}
+    /** Number of bytes obtained from the system since the last reset. */
+    size_t obtained() const {return total;}
+private:
+    arena(const arena &);
+    struct chunk {
+        char * data;
+        size_t size;
+        size_t used;
+    };
+    std::vector<chunk> chunks;
+    size_t used;
+    size_t total;
+    void add_chunk(size_t bytes);
+};
+
+/** The arena of the map that is loaded by the calling thread. */
+arena & map_arena();
+
+/** 
+ * Allocates from the arena of the map that is loaded by the calling thread.
+ * Containers using it must be emptied with release() before the map is unloaded.
+ */
+template<class T>
+struct arena_allocator {
+    typedef T value_type;
+    arena_allocator() {}
+    template<class U> arena_allocator(const arena_allocator<U> &) {}
+    T * allocate(size_t n) {
+        return (T*)map_arena().allocate(n * sizeof(T), alignof(T));
+    }
+    void deallocate(T *, size_t) {}
+};
+
+template<class T, class U>
+bool operator==(const arena_allocator<T> &, const arena_allocator<U> &) {return true;}
+template<class T, class U>
+bool operator!=(const arena_allocator<T> &, const arena_allocator<U> &) {return false;}
+
+template<class T>
+using arena_vector = std::vector<T, arena_allocator<T>>;
+
+/** Drops the memory of a vector, such that it no longer refers to the arena. */
+template<class T>
+void release(arena_vector<T> & v) {
+    arena_vector<T>().swap(v);
+}
+
+#endif
@@ -19,6 +19,7 @@
 #ifndef ART_H
 #define ART_H
 #include <stdint.h>
+#include <vector>
 #include <glm/glm.hpp>
 
 #define SCREEN_FULLSCREEN  0
@@ -31,10 +32,18 @@
 # define SCREEN_HEIGHT    960
 #endif
 
+// Implemented by the backend, which is either a window (art_sdl.cpp) or offscreen (art_offscreen.cpp).
 void init_screen(const char * caption);
-void clear_screen();
 void flip_screen();
+
+/** Sets up the OpenGL state once init_screen() has created the context. */
+void init_gl();
+void clear_screen();
 void set_matrix();
+/** Copies the last frame as rows of RGBA pixels, starting at the bottom. */
+void read_screen(std::vector<uint8_t> & pixels);
+/** Returns the product of the projection matrix and the view matrix of the current camera, as loaded by set_matrix(). */
+glm::dmat4 view_projection();
 
 void draw_box();
 void draw_cubemap(uint32_t texture); // OpenGL
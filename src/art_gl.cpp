@@ -22,8 +22,6 @@
 #include <unistd.h>
 #include <sys/mman.h>
 
-#include <SDL/SDL.h>
-
 #define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 #include <GL/glext.h>
@@ -39,43 +37,19 @@ using glm::min;
 using glm::max;
 
 namespace {
-    // The screen surface
-    SDL_Surface *screen = NULL;
     /** The projection matrix.
      * Note that we use a left handed axis system, hence we are initially looking down the positive Z-axis.
      * Up is positive Y and right is positive X.
      */
     const glm::dmat4 frustum_matrix = glm::scale(glm::frustum<double>(frustum::left, frustum::right, frustum::bottom, frustum::top, frustum::near, frustum::far),glm::dvec3(1,1,-1));
-}
-
-void init_screen(const char * caption) {
-    // Initialize SDL 
-    if (SDL_Init (SDL_INIT_VIDEO) < 0) {
-        fprintf (stderr, "Couldn't initialize SDL: %s\n", SDL_GetError ());
-        exit (2);
-    }
-    atexit (SDL_Quit);
-#if defined _WIN32 || defined _WIN64
-    freopen( "CON", "w", stdout );
-    freopen( "CON", "w", stderr );
-#endif
-
-    // Set 32-bits OpenGL video mode
-    SDL_GL_SetAttribute( SDL_GL_DOUBLEBUFFER, 1 );
-    SDL_GL_SetAttribute( SDL_GL_DEPTH_SIZE, 24 );
-    SDL_GL_SetAttribute( SDL_GL_RED_SIZE, 8 );
-    SDL_GL_SetAttribute( SDL_GL_GREEN_SIZE, 8 );
-    SDL_GL_SetAttribute( SDL_GL_BLUE_SIZE, 8 );
-    SDL_GL_SetAttribute( SDL_GL_MULTISAMPLEBUFFERS, 1);
-    SDL_GL_SetAttribute( SDL_GL_MULTISAMPLESAMPLES, 4);
-    // TODO: include SDL_RESIZABLE flag
-    screen = SDL_SetVideoMode (SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_OPENGL | (SCREEN_FULLSCREEN*SDL_FULLSCREEN));
-    if (screen == NULL) {
-        fprintf (stderr, "Couldn't set video mode: %s\n", SDL_GetError ());
-        exit (3);
+    
+    // The view matrix for the current camera.
+    glm::dmat4 view_matrix() {
+        return glm::translate(glm::dmat4(orientation),-camera_position-CAMERA_OFFSET);
     }
-    SDL_WM_SetCaption (caption, NULL);
+}
 
+void init_gl() {
     // Check OpenGL properties
     printf("OpenGL loaded\n");
     printf("Vendor:   %s\n", glGetString(GL_VENDOR));
@@ -99,20 +73,22 @@ void init_screen(const char * caption) {
     glMatrixMode(GL_MODELVIEW);
     
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    
-    // Other
-    clear_screen();
-    flip_screen();
 }
 
-void flip_screen() {
-    SDL_GL_SwapBuffers();
-}
 void clear_screen() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
+void read_screen(std::vector<uint8_t> & pixels) {
+    pixels.resize(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+}
+
 void set_matrix() {
-    glm::dmat4 view = glm::translate(glm::dmat4(orientation),-position-CAMERA_OFFSET);
-    glLoadMatrixd(glm::value_ptr(view));
+    glLoadMatrixd(glm::value_ptr(view_matrix()));
+}
+
+glm::dmat4 view_projection() {
+    return frustum_matrix * view_matrix();
 }
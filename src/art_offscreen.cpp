@@ -0,0 +1,53 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2013,2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <GL/osmesa.h>
+
+#include "art.h"
+
+namespace {
+    // The context renders with Mesa on the CPU into this buffer, hence no display or GPU is needed.
+    OSMesaContext context = NULL;
+    std::vector<unsigned char> buffer;
+}
+
+void init_screen(const char * caption) {
+    context = OSMesaCreateContextExt(OSMESA_RGBA, 24, 0, 0, NULL);
+    if (context == NULL) {
+        fprintf (stderr, "Couldn't create OSMesa context\n");
+        exit (2);
+    }
+    buffer.resize(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+    if (!OSMesaMakeCurrent(context, buffer.data(), GL_UNSIGNED_BYTE, SCREEN_WIDTH, SCREEN_HEIGHT)) {
+        fprintf (stderr, "Couldn't make OSMesa context current\n");
+        exit (3);
+    }
+    printf("Rendering %s offscreen\n", caption);
+
+    init_gl();
+    clear_screen();
+}
+
+void flip_screen() {
+    // Waits for the frame to be complete, such that frame times include the rendering.
+    glFinish();
+}
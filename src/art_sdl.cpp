@@ -0,0 +1,69 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2013,2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <SDL/SDL.h>
+
+#include "art.h"
+
+namespace {
+    // The screen surface
+    SDL_Surface *screen = NULL;
+}
+
+void init_screen(const char * caption) {
+    // Initialize SDL 
+    if (SDL_Init (SDL_INIT_VIDEO) < 0) {
+        fprintf (stderr, "Couldn't initialize SDL: %s\n", SDL_GetError ());
+        exit (2);
+    }
+    atexit (SDL_Quit);
+#if defined _WIN32 || defined _WIN64
+    freopen( "CON", "w", stdout );
+    freopen( "CON", "w", stderr );
+#endif
+
+    // Set 32-bits OpenGL video mode
+    SDL_GL_SetAttribute( SDL_GL_DOUBLEBUFFER, 1 );
+    SDL_GL_SetAttribute( SDL_GL_DEPTH_SIZE, 24 );
+    SDL_GL_SetAttribute( SDL_GL_RED_SIZE, 8 );
+    SDL_GL_SetAttribute( SDL_GL_GREEN_SIZE, 8 );
+    SDL_GL_SetAttribute( SDL_GL_BLUE_SIZE, 8 );
+    SDL_GL_SetAttribute( SDL_GL_MULTISAMPLEBUFFERS, 1);
+    SDL_GL_SetAttribute( SDL_GL_MULTISAMPLESAMPLES, 4);
+    SDL_GL_SetAttribute( SDL_GL_SWAP_CONTROL, 1);
+    // TODO: include SDL_RESIZABLE flag
+    screen = SDL_SetVideoMode (SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_OPENGL | (SCREEN_FULLSCREEN*SDL_FULLSCREEN));
+    if (screen == NULL) {
+        fprintf (stderr, "Couldn't set video mode: %s\n", SDL_GetError ());
+        exit (3);
+    }
+    SDL_WM_SetCaption (caption, NULL);
+
+    init_gl();
+    
+    // Other
+    clear_screen();
+    flip_screen();
+}
+
+void flip_screen() {
+    SDL_GL_SwapBuffers();
+}
@@ -0,0 +1,80 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+
+#include "bake.h"
+
+static const char MAGIC[8] = {'B','L','K','B','A','K','E','D'};
+
+bake::writer::writer(const char* filename) : file(fopen(filename, "wb")) {
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, MAGIC, sizeof(MAGIC));
+    head.version = VERSION;
+    if (!file) {
+        perror("Could not open file");
+        return;
+    }
+    // Reserve space for the header, it is written when all sections are known.
+    fwrite(&head, sizeof(head), 1, file);
+}
+
+bake::writer::~writer() {
+    if (!file) return;
+    fseek(file, 0, SEEK_SET);
+    fwrite(&head, sizeof(head), 1, file);
+    fclose(file);
+}
+
+void bake::writer::write(section s, const void* data, uint32_t length, uint32_t element_size) {
+    if (!file) return;
+    long offset = ftell(file);
+    static const char padding[ALIGNMENT] = {0};
+    fwrite(padding, 1, (ALIGNMENT - offset % ALIGNMENT) % ALIGNMENT, file);
+    head.sections[s].offset = ftell(file);
+    head.sections[s].length = length;
+    head.sections[s].element_size = element_size;
+    fwrite(data, element_size, length, file);
+}
+
+bake::reader::reader(const char* filename) : head(NULL), map(filename) {
+    if (map.size < sizeof(header)) return;
+    const header * h = (const header*)map.list;
+    if (memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        fprintf(stderr, "'%s' is not a baked map\n", filename);
+        return;
+    }
+    if (h->version != VERSION) {
+        fprintf(stderr, "'%s' has version %u, expected %u\n", filename, h->version, VERSION);
+        return;
+    }
+    for (int i=0; i<SECTIONS; i++) {
+        if (h->sections[i].offset + (uint64_t)h->sections[i].length * h->sections[i].element_size > map.size) {
+            fprintf(stderr, "'%s' is truncated\n", filename);
+            return;
+        }
+    }
+    head = h;
+}
+
+void bake::baked_name(char* out, const char* script, size_t n) {
+    snprintf(out, n, "%s", script);
+    char * point = strrchr(out, '.');
+    if (!point || strchr(point, '/')) point = out + strlen(out);
+    snprintf(point, n - (point - out), ".baked");
+}
@@ -0,0 +1,96 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BAKE_H
+#define BAKE_H
+
+#include <cstdio>
+#include <cstdint>
+#include "filemap.h"
+
+/**
+ * Baked maps contain the scenery as it is after executing the map script.
+ * The file starts with a header, followed by sections of raw arrays, 
+ * each aligned to a cache line such that they can be used directly from the memory map.
+ */
+namespace bake {
+    static const uint32_t VERSION = 1;
+    static const uint32_t ALIGNMENT = 64;
+    
+    enum flags {
+        /** The map script must be executed to obtain the tick function or gem actions. */
+        SCRIPTED = 1,
+    };
+    
+    enum section {
+        BLOCKS,
+        COORDINATES,
+        OBJECTS,
+        OBJECT_ENTRIES,
+        GEMS,
+        
+        SECTIONS
+    };
+    
+    struct header {
+        char magic[8];
+        uint32_t version;
+        uint32_t flags;
+        double start[3];
+        struct {
+            uint64_t offset;
+            uint32_t length;
+            uint32_t element_size;
+        } sections[SECTIONS];
+    };
+    
+    struct writer {
+        header head;
+        writer(const char * filename);
+        ~writer();
+        bool ok() const {return file!=NULL;}
+        void write(section s, const void * data, uint32_t length, uint32_t element_size);
+        template<class T>
+        void write(section s, const T * data, uint32_t length) {
+            write(s, data, length, sizeof(T));
+        }
+    private:
+        writer(const writer&);
+        FILE * file;
+    };
+    
+    struct reader {
+        const header * head;
+        reader(const char * filename);
+        bool ok() const {return head!=NULL;}
+        /** Returns the array stored in the given section, or NULL if it has an incompatible layout. */
+        template<class T>
+        const T * get(section s, uint32_t & length) const {
+            length = head->sections[s].length;
+            if (head->sections[s].element_size != sizeof(T) && length > 0) return NULL;
+            return (const T*)(map.list + head->sections[s].offset);
+        }
+    private:
+        filemap<char> map;
+    };
+    
+    /** Obtains the name of the baked version of the given map script. */
+    void baked_name(char * out, const char * script, size_t n);
+};
+
+#endif
@@ -0,0 +1,509 @@
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <physfs.h>
+#include "../scene.h"
+#include "../events.h"
+#include "../timing.h"
+#include "../jobs.h"
+#include "../arena.h"
+#include "../luaX.h"
+#include "../art.h"
+#include "../occlusion.h"
+#include "../scenery/scenery.h"
+#include "../xorshift.h"
+#include "bench.h"
+#include "../map_generate/generator.h"
+
+struct blocks;
+
+// Number of ticks that an agent keeps the same input.
+static const int INPUT_PERIOD = 30;
+
+// Mounts the directory of the map script and loads it.
+static bool load_map(const char * argv0, const char * input) {
+    char script[256];
+    if (!scene::mount_map_file(argv0, input, script, sizeof(script))) return false;
+    if (!scene::load(script)) {
+        fprintf(stderr, "Failed to load map '%s'\n", input);
+        return false;
+    }
+    return true;
+}
+
+// Generates random input, such that runs are repeatable.
+static player_input random_input(uint32_t & seed) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    player_input input = {
+        (seed & 1) != 0, (seed & 2) != 0 && (seed & 1) == 0, (seed & 4) != 0, (seed & 8) != 0 && (seed & 4) == 0, 
+        (seed & 16) != 0, true, 
+        (seed >> 8) * (2 * M_PI / (1 << 24)) - M_PI,
+    };
+    return input;
+}
+
+// Steps many players with random input through the loaded map, first on a single thread and then using all cores.
+static void bench_agents(int agents, int ticks) {
+    const player_state start = player;
+    for (int run=0; run<2; run++) {
+        if (run == 0) jobs::stop();
+        else jobs::start();
+        std::vector<player_state> players(agents, start);
+        std::vector<player_input> inputs(agents);
+        std::vector<uint32_t> seeds(agents);
+        for (int i=0; i<agents; i++) seeds[i] = i * 2654435761u + 1;
+        
+        Timer t;
+        for (int tick=0; tick<ticks; tick++) {
+            if (tick % INPUT_PERIOD == 0) {
+                for (int i=0; i<agents; i++) inputs[i] = random_input(seeds[i]);
+            }
+            scene::step_players(players, inputs);
+        }
+        double ms = t.elapsed();
+        
+        // The checksum must not depend on the number of workers.
+        double checksum = 0;
+        for (const player_state & p : players) checksum += p.position.x + p.position.y + p.position.z;
+        printf("%2u workers: %d agents x %d ticks in %8.1lf ms, %10.0lf agent-ticks/s, checksum %.6lf\n", 
+            jobs::workers(), agents, ticks, ms, agents * (double)ticks * 1000 / ms, checksum);
+    }
+}
+
+bool write_synthetic_map(const char * filename, int blocks, bool hint) {
+    FILE * f = fopen(filename, "w");
+    if (!f) {
+        perror("Could not write synthetic map");
+        return false;
+    }
+    if (hint) fprintf(f, "reserve_blocks(%d)\n", blocks);
+    fprintf(f,
+        "math.randomseed(1)\n"
+        "local side = math.ceil(math.sqrt(%d))\n"
+        "moving = {}\n"
+        "all = {}\n"
+        "for i=0,%d-1 do\n"
+        "  local x = (i %% side - side/2) * 3\n"
+        "  local z = (math.floor(i / side) - side/2) * 3\n"
+        "  local b = place_block({pos={x, math.random()*2, z}, size={1, 0.2+math.random(), 1}, color=math.random(0, 0xffffff)})\n"
+        "  if i %% 100 == 0 then moving[#moving+1] = {b, x, z} end\n"
+        "  all[#all+1] = b\n"
+        "end\n"
+        "everything = create_object(all, {0,0,0})\n"
+        "function move_all(n)\n"
+        "  for i,b in ipairs(all) do move_block(b, {pos={i %% 97, n %% 13, math.floor(i / 97)}}) end\n"
+        "end\n"
+        "function cast_rays(n)\n"
+        "  for i=1,100 do\n"
+        "    local a = (n*100+i) * 0.618\n"
+        "    raycast({math.cos(a)*side, 1, math.sin(a)*side}, {-math.cos(a), -0.02, -math.sin(a)}, side*3)\n"
+        "  end\n"
+        "end\n"
+        "function overlap_boxes(n)\n"
+        "  for i=1,100 do\n"
+        "    local a = (n*100+i) * 0.618\n"
+        "    overlap_box({math.cos(a)*side*i/100, 1, math.sin(a)*side*i/100}, {3, 1, 3})\n"
+        "  end\n"
+        "end\n"
+        "function move_and_cast(n)\n"
+        "  tick(n)\n"
+        "  cast_rays(n)\n"
+        "end\n"
+        "function rotate_all(n)\n"
+        "  rotate_object(everything, {angle=n*0.001, axis={0,1,0}, reset=1})\n"
+        "  update_object(everything)\n"
+        "end\n"
+        "function tick(n)\n"
+        "  for i,m in ipairs(moving) do move_block(m[1], {pos={m[2], 1+math.sin(n*0.1+i), m[3]}}) end\n"
+        "end\n"
+        "set_start({0, 4, 0})\n", blocks, blocks);
+    fclose(f);
+    return true;
+}
+
+// A carriage attached to a rotating wheel, and a copy of it that the script moves along the same circle by hand, as in wheel.map.
+static const char * ATTACH_MAP = 
+    "R = 5\n"
+    "H = 8\n"
+    "V = 0.05\n"
+    "function carriage()\n"
+    "  local list = {}\n"
+    "  list[1] = place_block({pos={0,H-R-1,0}, size={1,0.2,1}, color=0xff8080})\n"
+    "  list[2] = place_block({pos={0.8,H-R-0.2,0}, size={0.1,1,0.1}, color=0xff8080})\n"
+    "  list[3] = place_block({pos={0,H-R+0.9,0.5}, size={1,0.1,0.1}, color=0xff8080})\n"
+    "  return create_object(list, {0,H-R,0})\n"
+    "end\n"
+    "wheel = create_object({place_block({pos={0,H,0}, size={R,0.1,0.1}, color=0xffffff})}, {0,H,0})\n"
+    "attached = carriage()\n"
+    "attach_object(attached, wheel)\n"
+    "computed = carriage()\n"
+    "function tick(n)\n"
+    "  local ang = n*V\n"
+    "  rotate_object(wheel, {angle=ang, angle_vel=V, axis={0,0,1}, reset=1})\n"
+    "  rotate_object(attached, {angle=-ang, angle_vel=-V, axis={0,0,1}, reset=1})\n"
+    "  update_object(wheel)\n"
+    "  local a = -math.pi/2 + ang\n"
+    "  local ex, ey = math.cos(a)*R, math.sin(a)*R + R\n"
+    "  local fx, fy = math.cos(a+V)*R, math.sin(a+V)*R + R\n"
+    "  move_object(computed, {offset={ex,ey,0}, acceleration={fx-ex,fy-ey,0}, reset=1})\n"
+    "  update_object(computed)\n"
+    "end\n"
+    "set_start({20,1,0})\n";
+// Number of blocks of a carriage, which follow the block of the wheel.
+static const unsigned int CARRIAGE_BLOCKS = 3;
+
+// Compares the blocks of the attached carriage with those of the carriage that is moved by hand.
+static bool same_carriages(const char * phase) {
+    for (uint i=1; i<=CARRIAGE_BLOCKS; i++) {
+        glm::dvec3 attached_position, attached_velocity, computed_position, computed_velocity;
+        if (!scenery<blocks>::block_motion(i, attached_position, attached_velocity) || 
+            !scenery<blocks>::block_motion(i + CARRIAGE_BLOCKS, computed_position, computed_velocity)) {
+            fprintf(stderr, "Carriage blocks are missing\n");
+            return false;
+        }
+        double error = glm::length(attached_position - computed_position) + glm::length(attached_velocity - computed_velocity);
+        // A carriage that stands still would match trivially.
+        if (error > 1e-9 || glm::length(computed_velocity) < 1e-3) {
+            fprintf(stderr, "Attached block %u differs from the block moved by hand %s at move %u: position (%g %g %g) instead of (%g %g %g), velocity (%g %g %g) instead of (%g %g %g)\n",
+                i, phase, player.move_counter, 
+                attached_position.x, attached_position.y, attached_position.z, computed_position.x, computed_position.y, computed_position.z, 
+                attached_velocity.x, attached_velocity.y, attached_velocity.z, computed_velocity.x, computed_velocity.y, computed_velocity.z);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Simulates the given number of steps with the given button held, comparing the carriages after each step.
+static bool step_carriages(int steps, int button, const char * phase) {
+    set_button(button, true);
+    bool ok = true;
+    for (int step=0; step<steps && ok; step++) {
+        begin_step();
+        scene::interact();
+        move_player();
+        ok = same_carriages(phase);
+    }
+    set_button(button, false);
+    return ok;
+}
+
+/**
+ * Checks that an object attached to a rotating object moves like an object whose motion is computed by the script,
+ * while moving forward, while rewinding and after restarting the map.
+ */
+static int check_attach(const char * argv0) {
+    char dir[] = "/tmp/blockgame_bench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("Could not create temporary directory");
+        return 1;
+    }
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s/attach.map", dir);
+    FILE * f = fopen(filename, "w");
+    if (!f) {
+        perror("Could not write map");
+        rmdir(dir);
+        return 1;
+    }
+    fputs(ATTACH_MAP, f);
+    fclose(f);
+    PHYSFS_init(argv0);
+    PHYSFS_mount(dir, "/maps/", 1);
+    bool ok = scene::load("maps/attach.map");
+    if (!ok) fprintf(stderr, "Failed to load attach map\n");
+    ok = ok && step_carriages(100, button::ADVANCE, "moving forward");
+    ok = ok && step_carriages(40, button::REWIND, "while rewinding");
+    ok = ok && step_carriages(20, button::ADVANCE, "after rewinding");
+    if (ok) {
+        restart = true;
+        ok = step_carriages(30, button::ADVANCE, "after restarting");
+        if (ok && player.move_counter != 30) {
+            fprintf(stderr, "Map did not restart\n");
+            ok = false;
+        }
+    }
+    if (ok) printf("attached objects match the objects moved by the script\n");
+    scene::unload();
+    unlink(filename);
+    rmdir(dir);
+    return ok ? 0 : 1;
+}
+
+// Measures the memory used per block and the duration of a simulation step on a synthetic map.
+// The map is loaded with and without a block count hint.
+static int bench_blocks(const char * argv0, int blocks, int ticks) {
+    char dir[] = "/tmp/blockgame_bench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("Could not create temporary directory");
+        return 1;
+    }
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s/synthetic.map", dir);
+    PHYSFS_init(argv0);
+    PHYSFS_mount(dir, "/maps/", 1);
+    int result = 0;
+    for (int hint=0; hint<2 && result==0; hint++) {
+        if (!write_synthetic_map(filename, blocks, hint)) {
+            result = 1;
+            break;
+        }
+        Timer load;
+        if (!scene::load("maps/synthetic.map")) {
+            fprintf(stderr, "Failed to load synthetic map\n");
+            result = 1;
+            break;
+        }
+        double load_ms = load.elapsed();
+        size_t allocated = map_arena().allocated();
+        size_t obtained = map_arena().obtained();
+        
+        Timer t;
+        for (int tick=0; tick<ticks; tick++) {
+            begin_step();
+            scene::interact();
+            move_player();
+        }
+        double ms = t.elapsed();
+        size_t bytes = scene::memory();
+        printf("%d blocks, %s hint: loaded in %.1lf ms, arena %.1lf MiB allocated of %.1lf MiB obtained, %.1lf bytes/block, %.3lf ms/tick\n", 
+            blocks, hint?"with":"without", load_ms, allocated / 1048576.0, obtained / 1048576.0, bytes / (double)blocks, ms / ticks);
+        scene::unload();
+    }
+    unlink(filename);
+    rmdir(dir);
+    return result;
+}
+
+// Loads generated maps of increasing size and reports how loading, simulating and publishing a step scale.
+// Drawing needs a window, hence the publishing of the frame to the render thread is measured instead.
+static int bench_scaling(const char * argv0, uint32_t seed, int ticks) {
+    char dir[] = "/tmp/blockgame_bench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("Could not create temporary directory");
+        return 1;
+    }
+    PHYSFS_init(argv0);
+    PHYSFS_mount(dir, "/maps/", 1);
+    PHYSFS_mount(dir, "/records/", 1);
+    printf("size,blocks,load_ms,tick_ms,publish_ms,bytes\n");
+    int result = 0;
+    for (int size=1000; size<=100000 && result==0; size*=10) {
+        stress_map m = default_stress_map();
+        m.seed = seed;
+        m.static_blocks = size;
+        m.rotated_blocks = size / 10;
+        m.objects = size / 100;
+        m.gems = size / 1000;
+        m.ghosts = size / 1000;
+        if (!generate_map(m, dir, "stress", dir)) {
+            result = 1;
+            break;
+        }
+        Timer load;
+        if (!scene::load("maps/stress.map")) {
+            fprintf(stderr, "Failed to load generated map\n");
+            result = 1;
+            break;
+        }
+        double load_ms = load.elapsed();
+        double tick_ms = 0, publish_ms = 0;
+        for (int tick=0; tick<ticks; tick++) {
+            Timer t;
+            begin_step();
+            scene::interact();
+            move_player();
+            tick_ms += t.elapsed();
+            Timer p;
+            scene::publish(tick * MILLISECONDS_PER_STEP);
+            publish_ms += p.elapsed();
+        }
+        int blocks = m.static_blocks + m.rotated_blocks + m.objects * m.object_blocks;
+        printf("%d,%d,%.1lf,%.3lf,%.3lf,%zu\n", size, blocks, load_ms, tick_ms / ticks, publish_ms / ticks, scene::memory());
+        fflush(stdout);
+        scene::unload();
+        char filename[PATH_MAX];
+        snprintf(filename, sizeof(filename), "%s/stress.map", dir);
+        unlink(filename);
+        for (int i=0; i<m.ghosts; i++) {
+            snprintf(filename, sizeof(filename), "%s/stress_%d.rec", dir, i);
+            unlink(filename);
+        }
+    }
+    rmdir(dir);
+    return result;
+}
+
+// Measures the duration of the simulation steps of a map, including its tick function.
+static void bench_ticks(int ticks) {
+    Timer t;
+    for (int tick=0; tick<ticks; tick++) {
+        begin_step();
+        scene::interact();
+        move_player();
+    }
+    double ms = t.elapsed();
+    printf("%s: %d ticks in %.1lf ms, %.3lf ms/tick\n", luaX_backend(), ticks, ms, ms / ticks);
+}
+
+// Appends the corners of a block in the order used by scenery<blocks>.
+static void add_box(std::vector<point3fc> & blocks, float x, float y, float z, float sx, float sy, float sz) {
+    for (int j=0; j<8; j++) {
+        point3fc p = {x + (j&4 ? sx : -sx), y + (j&2 ? sy : -sy), z + (j&1 ? sz : -sz), 0};
+        blocks.push_back(p);
+    }
+}
+
+/**
+ * Checks that a block seen through a gap between two occluders, narrower than a pixel of the depth buffer,
+ * is not culled, while a block of the same size right behind one of the occluders is.
+ */
+static bool check_occlusion_gap() {
+    orientation = glm::dmat3();
+    camera_position = glm::dvec3();
+    glm::dmat4 m = view_projection();
+    // Width of a pixel of the depth buffer at the distance of the occluders.
+    const double DISTANCE = 10;
+    glm::dvec4 a = m * glm::dvec4(0, 0, DISTANCE, 1);
+    glm::dvec4 b = m * glm::dvec4(1, 0, DISTANCE, 1);
+    double pixels = (b.x / b.w - a.x / a.w) * 0.5 * occlusion::WIDTH;
+    float gap = 0.3 / pixels;
+    
+    // The clusters are the occluders, the block behind the gap and the block behind an occluder.
+    std::vector<point3fc> blocks;
+    for (uint k=0; k<occlusion::CLUSTER_SIZE; k++) {
+        float side = k%2 ? 1 : -1;
+        add_box(blocks, side * (5 + gap/2), 0, DISTANCE, 5, 5, 1);
+    }
+    for (uint k=0; k<occlusion::CLUSTER_SIZE; k++) {
+        add_box(blocks, 0, 0, 2*DISTANCE, gap/4, 0.5, 0.5);
+    }
+    for (uint k=0; k<occlusion::CLUSTER_SIZE; k++) {
+        add_box(blocks, 3, 0, 2*DISTANCE, 0.5, 0.5, 0.5);
+    }
+    std::vector<unsigned int> visible;
+    occlusion::cull(blocks.data(), blocks.size() / 8, glm::mat4(m), glm::vec3(camera_position), visible);
+    bool through_gap = std::find(visible.begin(), visible.end(), 1) != visible.end();
+    bool behind = std::find(visible.begin(), visible.end(), 2) != visible.end();
+    printf("occlusion gap of %.2f pixels: block behind gap %s, block behind occluder %s\n", 
+        gap * pixels, through_gap ? "visible" : "culled", behind ? "visible" : "culled");
+    if (!through_gap) fprintf(stderr, "Block seen through a gap between occluders was culled\n");
+    if (behind) fprintf(stderr, "Block behind an occluder was not culled\n");
+    return through_gap && !behind;
+}
+
+// Measures occlusion culling on a generated city, seen from a camera that walks along one of its streets.
+static void bench_occlusion(int side, int frames) {
+    const float SPACING = 10;
+    std::vector<point3fc> blocks;
+    xorshift random(1);
+    for (int i=0; i<side; i++) {
+        for (int j=0; j<side; j++) {
+            // Each cluster holds a building and the small blocks around it.
+            float x = i*SPACING, z = j*SPACING;
+            float height = random.uniform(4, 20);
+            add_box(blocks, x, height/2, z, 3, height/2, 3);
+            for (uint k=1; k<occlusion::CLUSTER_SIZE; k++) {
+                add_box(blocks, x + random.uniform(-3.5, 3.5), random.uniform(0, height), z + random.uniform(-3.5, 3.5), 0.3, 0.3, 0.3);
+            }
+        }
+    }
+    uint n = blocks.size() / 8;
+    uint clusters = (n + occlusion::CLUSTER_SIZE - 1) / occlusion::CLUSTER_SIZE;
+    
+    std::vector<unsigned int> visible;
+    unsigned long drawn = 0;
+    orientation = glm::dmat3();
+    Timer t;
+    for (int f=0; f<frames; f++) {
+        camera_position = glm::dvec3((side/2 - 0.5) * SPACING, 1.5, -SPACING + f * (side+1) * SPACING / frames);
+        visible.clear();
+        occlusion::cull(blocks.data(), n, glm::mat4(view_projection()), glm::vec3(camera_position), visible);
+        drawn += visible.size();
+    }
+    double ms = t.elapsed();
+    printf("%u blocks in %u clusters, %d frames: %.1lf clusters drawn per frame, %.1lf%% occluded, %.3lf ms per frame\n",
+        n, clusters, frames, drawn / (double)frames, 100 - drawn * 100.0 / ((double)clusters * frames), ms / frames);
+}
+
+/**
+ * Benchmarks of the engine, which run without opening a window.
+ */
+int main(int argc, const char ** argv) {
+    if (argc>=3 && argc<=5 && strcmp(argv[1], "agents")==0) {
+        if (!load_map(argv[0], argv[2])) {
+            PHYSFS_deinit();
+            return 1;
+        }
+        int agents = argc>=4 ? atoi(argv[3]) : 1000;
+        int ticks = argc>=5 ? atoi(argv[4]) : 1000;
+        bench_agents(agents, ticks);
+        scene::unload();
+        jobs::stop();
+        PHYSFS_deinit();
+        return 0;
+    }
+    if (argc>=2 && argc<=4 && strcmp(argv[1], "blocks")==0) {
+        int blocks = argc>=3 ? atoi(argv[2]) : 100000;
+        int ticks = argc>=4 ? atoi(argv[3]) : 100;
+        jobs::start();
+        int result = bench_blocks(argv[0], blocks, ticks);
+        scene::unload();
+        jobs::stop();
+        PHYSFS_deinit();
+        return result;
+    }
+    if (argc>=3 && argc<=4 && strcmp(argv[1], "ticks")==0) {
+        jobs::start();
+        if (!load_map(argv[0], argv[2])) {
+            jobs::stop();
+            PHYSFS_deinit();
+            return 1;
+        }
+        bench_ticks(argc>=4 ? atoi(argv[3]) : 1000);
+        scene::unload();
+        jobs::stop();
+        PHYSFS_deinit();
+        return 0;
+    }
+    if (argc>=2 && argc<=4 && strcmp(argv[1], "scaling")==0) {
+        uint32_t seed = argc>=3 ? strtoul(argv[2], NULL, 10) : 1;
+        int ticks = argc>=4 ? atoi(argv[3]) : 100;
+        jobs::start();
+        int result = bench_scaling(argv[0], seed, ticks);
+        jobs::stop();
+        PHYSFS_deinit();
+        return result;
+    }
+    if (argc==2 && strcmp(argv[1], "attach")==0) {
+        jobs::start();
+        int result = check_attach(argv[0]);
+        jobs::stop();
+        PHYSFS_deinit();
+        return result;
+    }
+    if (argc>=2 && argc<=4 && strcmp(argv[1], "occlusion")==0) {
+        if (!check_occlusion_gap()) return 1;
+        bench_occlusion(argc>=3 ? atoi(argv[2]) : 32, argc>=4 ? atoi(argv[3]) : 1000);
+        return 0;
+    }
+    if (argc>=2 && strcmp(argv[1], "suite")==0) {
+        return run_suite(argv[0], argc-2, argv+2);
+    }
+    printf("Usage: %s agents mapscript [agents] [ticks]\n", argv[0]);
+    printf("       %s ticks mapscript [ticks]\n", argv[0]);
+    printf("       %s blocks [blocks] [ticks]\n", argv[0]);
+    printf("       %s scaling [seed] [ticks]\n", argv[0]);
+    printf("       %s attach\n", argv[0]);
+    printf("       %s occlusion [side] [frames]\n", argv[0]);
+    printf("       %s suite [--json] [sizes...]\n", argv[0]);
+    return 1;
+}
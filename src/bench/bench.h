@@ -0,0 +1,13 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/** 
+ * Writes a map script with the given number of blocks on a grid, of which one in a hundred moves every tick.
+ * All blocks are also part of one object. With hint set, the script tells how many blocks it will place.
+ */
+bool write_synthetic_map(const char * filename, int blocks, bool hint);
+
+/** Runs the microbenchmarks of the engine and prints the results as CSV or JSON. */
+int run_suite(const char * argv0, int argc, const char ** argv);
+
+#endif
@@ -0,0 +1,196 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <vector>
+#include <unistd.h>
+#include <lua.hpp>
+#include <physfs.h>
+#include "../scene.h"
+#include "../events.h"
+#include "../timing.h"
+#include "../jobs.h"
+#include "../luaX.h"
+#include "../scenery/scenery.h"
+#include "bench.h"
+
+struct blocks;
+
+// Number of times the benchmarks that take the whole scene are repeated.
+static const int SCENE_REPEATS = 20;
+
+struct result {
+    const char * benchmark;
+    int size;
+    long iterations;
+    double ms;
+};
+
+static std::vector<result> results;
+
+// Runs the function once, which performs the given number of iterations, and stores its duration.
+template<class F>
+static void measure(const char * benchmark, int size, long iterations, F f) {
+    Timer t;
+    f();
+    result r = {benchmark, size, iterations, t.elapsed()};
+    results.push_back(r);
+}
+
+static void print_results(bool json) {
+    if (json) {
+        printf("[\n");
+        for (size_t i=0; i<results.size(); i++) {
+            const result & r = results[i];
+            printf("  {\"benchmark\": \"%s\", \"size\": %d, \"iterations\": %ld, \"ms\": %.3lf, \"ns_per_op\": %.1lf}%s\n",
+                r.benchmark, r.size, r.iterations, r.ms, r.ms * 1e6 / r.iterations, i+1<results.size() ? "," : "");
+        }
+        printf("]\n");
+    } else {
+        printf("benchmark,size,iterations,ms,ns_per_op\n");
+        for (const result & r : results) {
+            printf("%s,%d,%ld,%.3lf,%.1lf\n", r.benchmark, r.size, r.iterations, r.ms, r.ms * 1e6 / r.iterations);
+        }
+    }
+}
+
+// Marshalling of the tables that are passed to place_block and friends.
+static void bench_marshalling(int size) {
+    lua_State * L = luaL_newstate();
+    luaL_loadstring(L, "return {pos={1,2,3}, vel={0,0.1,0}, size={1,1,1}}");
+    lua_pcall(L, 0, 1, 0);
+    glm::dvec3 sum;
+    measure("luaX_get_vector", size, size * 3L, [&]{
+        for (int i=0; i<size; i++) {
+            if (luaX_check_field(L, 1, "pos")) sum += luaX_get_vector(L);
+            if (luaX_check_field(L, 1, "vel")) sum += luaX_get_vector(L);
+            if (luaX_check_field(L, 1, "size")) sum += luaX_get_vector(L);
+        }
+    });
+    measure("luaX_check_field_missing", size, size, [&]{
+        for (int i=0; i<size; i++) {
+            if (luaX_check_field(L, 1, "color")) lua_pop(L, 1);
+        }
+    });
+    lua_close(L);
+    if (sum.x < 0) printf("%lf\n", sum.x);
+}
+
+// Benchmarks on the synthetic map with the given number of blocks.
+static bool bench_scene(int size, const char * dir) {
+    char filename[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s/synthetic.map", dir);
+    if (!write_synthetic_map(filename, size, true)) return false;
+
+    bool ok = true;
+    measure("execute_script", size, size, [&]{
+        ok = scene::load("maps/synthetic.map");
+    });
+    unlink(filename);
+    if (!ok) {
+        fprintf(stderr, "Failed to load synthetic map\n");
+        return false;
+    }
+
+    // A player in the middle of the map, where it touches some blocks.
+    player_state p = player;
+    p.position = glm::dvec3(0, 1, 0);
+    measure("blocks_interact", size, (long)size * SCENE_REPEATS, [&]{
+        for (int i=0; i<SCENE_REPEATS; i++) {
+            player_state q = p;
+            scenery<blocks>::interact(NULL, q);
+        }
+    });
+    measure("blocks_collide", size, (long)size * SCENE_REPEATS, [&]{
+        for (int i=0; i<SCENE_REPEATS; i++) {
+            player_state q = p;
+            scenery<blocks>::collide(q);
+        }
+    });
+    // The first query builds the spatial index, which is included in the measurement.
+    measure("raycast", size, 100L * SCENE_REPEATS, [&]{
+        for (int i=0; i<SCENE_REPEATS && ok; i++) ok = scene::call("cast_rays", i);
+    });
+    measure("overlap_box", size, 100L * SCENE_REPEATS, [&]{
+        for (int i=0; i<SCENE_REPEATS && ok; i++) ok = scene::call("overlap_boxes", i);
+    });
+    // Moves one in a hundred blocks before each batch of rays, such that the index must be updated for every batch.
+    measure("raycast_moving", size, 100L * SCENE_REPEATS, [&]{
+        for (int i=0; i<SCENE_REPEATS && ok; i++) ok = scene::call("move_and_cast", i);
+    });
+    // move_block recomputes a single block, update_object all blocks of the object.
+    measure("move_block", size, (long)size * SCENE_REPEATS, [&]{
+        for (int i=0; i<SCENE_REPEATS && ok; i++) ok = scene::call("move_all", i);
+    });
+    measure("update_object", size, (long)size * SCENE_REPEATS, [&]{
+        for (int i=0; i<SCENE_REPEATS && ok; i++) ok = scene::call("rotate_all", i);
+    });
+    scene::unload();
+
+    // A record of a run that takes the given number of steps.
+    reset(glm::dvec3(0, 1, 0), "maps/synthetic.map");
+    for (int i=0; i<size; i++) {
+        begin_step();
+        move_player();
+    }
+    measure("record_write", size, size, [&]{
+        finish(player.position, "bench.rec");
+    });
+    std::vector<point3f> record;
+    measure("record_read", size, size, [&]{
+        PHYSFS_File * r = PHYSFS_openRead("records/bench.rec");
+        if (r) {
+            record.resize(PHYSFS_fileLength(r) / sizeof(point3f));
+            PHYSFS_read(r, record.data(), sizeof(point3f), record.size());
+            PHYSFS_close(r);
+        }
+    });
+    if (record.size() < (size_t)size) {
+        fprintf(stderr, "Failed to read back the record\n");
+        ok = false;
+    }
+    snprintf(filename, sizeof(filename), "%s/bench.rec", dir);
+    unlink(filename);
+    snprintf(filename, sizeof(filename), "%s/bench.rec.inputs", dir);
+    unlink(filename);
+    return ok;
+}
+
+int run_suite(const char * argv0, int argc, const char ** argv) {
+    bool json = false;
+    std::vector<int> sizes;
+    for (int i=0; i<argc; i++) {
+        if (strcmp(argv[i], "--json")==0) {
+            json = true;
+        } else if (atoi(argv[i]) > 0) {
+            sizes.push_back(atoi(argv[i]));
+        } else {
+            fprintf(stderr, "Invalid size '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+    if (sizes.empty()) sizes = {1000, 10000, 100000};
+
+    char dir[] = "/tmp/blockgame_bench.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("Could not create temporary directory");
+        return 1;
+    }
+    PHYSFS_init(argv0);
+    PHYSFS_mount(dir, "/maps/", 1);
+    PHYSFS_mount(dir, "/records/", 1);
+    PHYSFS_setWriteDir(dir);
+    jobs::start();
+
+    bool ok = true;
+    for (int size : sizes) {
+        bench_marshalling(size);
+        ok = ok && bench_scene(size, dir);
+    }
+
+    jobs::stop();
+    PHYSFS_deinit();
+    rmdir(dir);
+    print_results(json);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <algorithm>
+
+#include "cellfile.h"
+
+static const char MAGIC[8] = {'B','L','K','C','E','L','L','S'};
+
+bool cellfile::write(const char * filename, const std::vector<block> & blocks, float cell_size) {
+    std::map<std::pair<int32_t,int32_t>, std::vector<block>> cells;
+    header head;
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, MAGIC, sizeof(MAGIC));
+    head.version = VERSION;
+    head.cell_size = cell_size;
+    for (const block & b : blocks) {
+        cells[std::make_pair(cell_of(b.position[0], cell_size), cell_of(b.position[2], cell_size))].push_back(b);
+        float extent = std::sqrt(b.size[0]*b.size[0] + b.size[1]*b.size[1] + b.size[2]*b.size[2]);
+        head.max_extent = std::max(head.max_extent, extent);
+    }
+    head.cells = cells.size();
+    
+    FILE * file = fopen(filename, "wb");
+    if (!file) {
+        perror("Could not open file");
+        return false;
+    }
+    std::vector<cell_entry> index;
+    uint64_t offset = sizeof(header) + cells.size() * sizeof(cell_entry);
+    for (const auto & c : cells) {
+        offset += (ALIGNMENT - offset % ALIGNMENT) % ALIGNMENT;
+        cell_entry e = {c.first.first, c.first.second, offset, (uint32_t)c.second.size(), 0};
+        index.push_back(e);
+        offset += c.second.size() * sizeof(block);
+    }
+    fwrite(&head, sizeof(head), 1, file);
+    fwrite(index.data(), sizeof(cell_entry), index.size(), file);
+    static const char padding[ALIGNMENT] = {0};
+    for (const auto & c : cells) {
+        long position = ftell(file);
+        fwrite(padding, 1, (ALIGNMENT - position % ALIGNMENT) % ALIGNMENT, file);
+        fwrite(c.second.data(), sizeof(block), c.second.size(), file);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+const cellfile::header * cellfile::check(const char * data, uint64_t size, const char * filename) {
+    if (size < sizeof(header)) {
+        fprintf(stderr, "'%s' is not a cell file\n", filename);
+        return NULL;
+    }
+    const header * h = (const header*)data;
+    if (memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        fprintf(stderr, "'%s' is not a cell file\n", filename);
+        return NULL;
+    }
+    if (h->version != VERSION) {
+        fprintf(stderr, "'%s' has version %u, expected %u\n", filename, h->version, VERSION);
+        return NULL;
+    }
+    if (sizeof(header) + (uint64_t)h->cells * sizeof(cell_entry) > size) {
+        fprintf(stderr, "'%s' is truncated\n", filename);
+        return NULL;
+    }
+    const cell_entry * index = (const cell_entry*)(h + 1);
+    for (uint32_t i=0; i<h->cells; i++) {
+        if (index[i].offset + (uint64_t)index[i].blocks * sizeof(block) > size) {
+            fprintf(stderr, "'%s' is truncated\n", filename);
+            return NULL;
+        }
+    }
+    return h;
+}
@@ -0,0 +1,71 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CELLFILE_H
+#define CELLFILE_H
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+
+/**
+ * Cell files contain the static blocks of a large world, partitioned into square cells
+ * on the xz-plane, such that only the cells near the player need to be in memory.
+ * The file starts with a header and the index of all cells, followed by the blocks of each cell,
+ * aligned to a cache line.
+ */
+namespace cellfile {
+    static const uint32_t VERSION = 1;
+    static const uint32_t ALIGNMENT = 64;
+    
+    struct header {
+        char magic[8];
+        uint32_t version;
+        uint32_t cells;
+        float cell_size;
+        /** Largest distance from the center of a block to its corners. */
+        float max_extent;
+    };
+    
+    struct cell_entry {
+        int32_t x, z;
+        uint64_t offset;
+        uint32_t blocks;
+        uint32_t padding;
+    };
+    
+    struct block {
+        float position[3];
+        float size[3];
+        float rotation[4]; // quaternion (w,x,y,z)
+        uint32_t color;
+    };
+    
+    /** Returns the cell that contains the given coordinate. */
+    inline int32_t cell_of(double coordinate, float cell_size) {
+        return (int32_t)std::floor(coordinate / cell_size);
+    }
+    
+    /** Sorts the blocks into cells by their center and writes them to a cell file. */
+    bool write(const char * filename, const std::vector<block> & blocks, float cell_size);
+    
+    /** Validates the cell file in memory. Returns its header, or NULL if it is invalid. */
+    const header * check(const char * data, uint64_t size, const char * filename);
+};
+
+#endif
@@ -17,58 +17,63 @@
 */
 
 #include <glm/gtc/matrix_transform.hpp>
-#include <SDL/SDL.h>
 #include <vector>
+#include <cstdio>
 #include <physfs.h>
+#include <string.h>
+#include <errno.h>
 
 #include "events.h"
 #include "point_types.h"
-#include "keymap.h"
-
-// Buttons
-class button {
-    public:
-    enum {
-        FORWARD, BACKWARD, LEFT, RIGHT, 
-        JUMP, ADVANCE, REWIND, 
-        
-        STATES
-    };
-};
 
-static const double ROTATE_SPEED =  0.01;
 static const double MOVE_SPEED = 0.15;
 static const double JUMP_SPEED = 0.4;
-static const int MILLISECONDS_PER_FRAME = 33;
 static const double GROUND_CONTROL = 0.3;
 static const double AIR_CONTROL = 0.05;
 static const glm::dvec3 GRAVITY(0,-0.02,0);
 static const int HISTORY = 1024;
+static const char INPUT_LOG_MAGIC[8] = {'B','L','K','I','N','P','U','T'};
+static const uint32_t INPUT_LOG_VERSION = 1;
+
+struct input_log_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t steps;
+    char map_file[256];
+};
 
-static bool button_state[button::STATES];
-static bool mousemove=false;
+// Written by the render thread, which handles the events, and read by the simulation thread.
+static std::atomic<bool> button_state[button::STATES];
 static std::vector<glm::dvec3> old_position;
 static std::vector<glm::dvec3> old_velocity;
-static double tau=0, phi=0;
+static std::atomic<double> tau(0), phi(0);
+static glm::dvec3 previous_position;
+static std::vector<logged_input> input_log;
+static char input_log_map[256];
 
-bool airborne = false;
-bool reload = false;
-glm::dvec3 ground_vel;
-bool quit  = false;
+std::atomic<bool> reload(false);
+std::atomic<bool> restart(false);
+std::atomic<bool> quit(false);
+player_state player;
 glm::dmat3 orientation;
-glm::dvec3 position;
-glm::dvec3 velocity;
-uint move_counter;
-
-void reset(glm::dvec3 start_position) {
-    position = start_position;
-    velocity = glm::dvec3(0,0,0);
-    ground_vel = glm::dvec3(0,0,0);
-    airborne = false;
+void (*record_hook)(const std::vector<point3f> & record) = NULL;
+double interpolation = 1;
+glm::dvec3 camera_position;
+
+void reset(glm::dvec3 start_position, const char * map_file) {
+    player.position = start_position;
+    previous_position = start_position;
+    player.velocity = glm::dvec3(0,0,0);
+    player.ground_vel = glm::dvec3(0,0,0);
+    player.airborne = false;
     tau=0; phi=0;
     old_position.clear();
     old_velocity.clear();
-    move_counter = 0;
+    player.move_counter = 0;
+    input_log.clear();
+    if (map_file != input_log_map) {
+        strncpy(input_log_map, map_file, sizeof(input_log_map)-1);
+    }
 }
 
 /** Finishes the enemy recording and moves it to the specified file. 
@@ -88,6 +93,10 @@ void finish(glm::dvec3 end_position, const char * target_file) {
         point3f pt = {(float)p.x,(float)p.y,(float)p.z};
         record.push_back(pt);
     }
+    if (record_hook) {
+        record_hook(record);
+        return;
+    }
     PHYSFS_File * w = PHYSFS_openWrite(target_file);
     if (w) {
         PHYSFS_write(w, record.data(), sizeof(point3f), record.size());
@@ -95,154 +104,200 @@ void finish(glm::dvec3 end_position, const char * target_file) {
     } else {
         fprintf(stderr, "Failed to write record: %s\n", PHYSFS_getLastError());
     }
+    
+    // Store the input, such that the record can be verified.
+    char log_file[300];
+    snprintf(log_file, 300, "%s.inputs", target_file);
+    input_log_header header = input_log_header();
+    memcpy(header.magic, INPUT_LOG_MAGIC, sizeof(header.magic));
+    header.version = INPUT_LOG_VERSION;
+    header.steps = input_log.size();
+    strncpy(header.map_file, input_log_map, sizeof(header.map_file)-1);
+    w = PHYSFS_openWrite(log_file);
+    if (w) {
+        PHYSFS_write(w, &header, sizeof(header), 1);
+        PHYSFS_write(w, input_log.data(), sizeof(logged_input), input_log.size());
+        PHYSFS_close(w);
+    } else {
+        fprintf(stderr, "Failed to write input log: %s\n", PHYSFS_getLastError());
+    }
 }
 
-// checks user input
-void handle_events() {
-    SDL_Event event;
-  
-    /* Check for events */
-    while (SDL_PollEvent (&event)) {
-        switch (event.type) {
-        case SDL_KEYUP:
-        case SDL_KEYDOWN: {
-            bool state = (event.type == SDL_KEYDOWN);
-            switch (event.key.keysym.sym) {
-                case SDLK_ESCAPE:
-                    quit = true;
-                    break;
-                case SDLK_F5:
-                    reload = true;
-                    break;
-                case KEY_FORWARD:
-                    button_state[button::FORWARD] = state;
-                    break;
-                case KEY_BACKWARD:
-                    button_state[button::BACKWARD] = state;
-                    break;
-                case KEY_LEFT:
-                    button_state[button::LEFT] = state;
-                    break;
-                case KEY_RIGHT:
-                    button_state[button::RIGHT] = state;
-                    break;
-                case KEY_JUMP:
-                    button_state[button::JUMP] = state;
-                    break;
-                case KEY_ADVANCE:
-                    button_state[button::ADVANCE] = state;
-                    break;
-                case KEY_REWIND:
-                    button_state[button::REWIND] = state;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        }
-        case SDL_MOUSEBUTTONDOWN: {
-            SDL_ShowCursor(mousemove);
-            mousemove=!mousemove;
-            SDL_WM_GrabInput(mousemove?SDL_GRAB_ON:SDL_GRAB_OFF);
-            break;
-        }
-        case SDL_MOUSEMOTION: {
-            if (mousemove) {
-                tau -= event.motion.xrel*ROTATE_SPEED;
-                phi -= event.motion.yrel*ROTATE_SPEED;
-                if (tau> M_PI) tau -= 2*M_PI;
-                if (tau<-M_PI) tau += 2*M_PI;
-                if (phi> M_PI/2) phi =  M_PI/2;
-                if (phi<-M_PI/2) phi = -M_PI/2;
-            }
-            break;
-        }
-        case SDL_QUIT:
-            quit = true;
-            break;
-        default:
-            break;
-        }
+bool read_input_log(const char * filename, char * map_file, size_t map_file_size, std::vector<logged_input> & inputs) {
+    FILE * f = fopen(filename, "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open input log '%s': %s\n", filename, strerror(errno));
+        return false;
     }
-    
+    input_log_header header;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 && 
+        memcmp(header.magic, INPUT_LOG_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == INPUT_LOG_VERSION;
+    if (ok) {
+        // The steps must fill the rest of the file, such that a corrupt header cannot cause a huge allocation.
+        long position = ftell(f);
+        ok = position >= 0 && fseek(f, 0, SEEK_END) == 0 &&
+            (uint64_t)(ftell(f) - position) == (uint64_t)header.steps * sizeof(logged_input) &&
+            fseek(f, position, SEEK_SET) == 0;
+    }
+    if (ok) {
+        inputs.resize(header.steps);
+        ok = fread(inputs.data(), sizeof(logged_input), header.steps, f) == header.steps;
+    }
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "Input log '%s' is invalid\n", filename);
+        return false;
+    }
+    header.map_file[sizeof(header.map_file)-1] = 0;
+    snprintf(map_file, map_file_size, "%s", header.map_file);
+    return true;
+}
+
+static bool held(const logged_input & input, int b) {
+    return (input.buttons >> b) & 1;
+}
+
+// Obtains the input of a step from its entry in the input log.
+static player_input decode_input(const logged_input & input) {
+    player_input p = {
+        held(input, button::FORWARD), held(input, button::BACKWARD), 
+        held(input, button::LEFT), held(input, button::RIGHT), 
+        held(input, button::JUMP), held(input, button::ADVANCE), 
+        input.tau,
+    };
+    return p;
+}
+
+void replay_input(const logged_input & input) {
+    for (int i=0; i<button::STATES; i++) {
+        button_state[i] = held(input, i);
+    }
+    tau = input.tau;
+}
+
+void set_button(int b, bool state) {
+    button_state[b] = state;
+}
+
+void turn_camera(double dtau, double dphi) {
+    double t = tau + dtau;
+    double p = phi + dphi;
+    if (t> M_PI) t -= 2*M_PI;
+    if (t<-M_PI) t += 2*M_PI;
+    if (p> M_PI/2) p =  M_PI/2;
+    if (p<-M_PI/2) p = -M_PI/2;
+    tau = t;
+    phi = p;
+}
+
+void orient_camera() {
+    glm::dmat4 view;
+    view = glm::rotate(view, tau.load(), glm::dvec3(0,1,0));
+    glm::dmat3 M = glm::transpose(glm::dmat3(view));
+    view = glm::rotate(view, phi.load(), M[0]);
+    orientation = glm::dmat3(view);
+}
+
+// Stores the state at the start of a simulation step, which is used for interpolation.
+void begin_step() {
+    previous_position = player.position;
+}
+
+bool step_player(player_state & p, const player_input & input) {
     // Yaw camera
     glm::dmat4 view;
-    view = glm::rotate(view, tau, glm::dvec3(0,1,0));
+    view = glm::rotate(view, input.tau, glm::dvec3(0,1,0));
     
     // Obtain current axes
     glm::dmat3 M = glm::transpose(glm::dmat3(view));
     
-    if (button_state[button::REWIND]) {
-        if (!old_position.empty()) {
-            position = old_position.back(); old_position.pop_back();
-            velocity = old_velocity.back(); old_velocity.pop_back();
-            move_counter--;
-        }
+    // Apply drag.
+    if (p.airborne) {
+        p.velocity *= (1-AIR_CONTROL);
     } else {
-        glm::dvec3 prev_velocity = velocity;
-        
-        // Apply drag.
-        if (airborne) {
-            velocity *= (1-AIR_CONTROL);
-        } else {
-            velocity -= ground_vel;
-            velocity *= (1-GROUND_CONTROL);
-        }
+        p.velocity -= p.ground_vel;
+        p.velocity *= (1-GROUND_CONTROL);
+    }
+    
+    // Apply control
+    double dist = (p.airborne?AIR_CONTROL:GROUND_CONTROL) * MOVE_SPEED;
+    if (
+        (input.forward != input.left) &&
+        (input.backward != input.right)
+    ) {
+        dist *= 0.7071;
+    }
         
-        // Apply control
-        double dist = (airborne?AIR_CONTROL:GROUND_CONTROL) * MOVE_SPEED;
-        if (
-            (button_state[button::FORWARD] != button_state[button::LEFT]) &&
-            (button_state[button::BACKWARD] != button_state[button::RIGHT])
-        ) {
-            dist *= 0.7071;
-        }
-            
-        if (button_state[button::FORWARD]) {
-            velocity += dist * M[2];
-        }
-        if (button_state[button::BACKWARD]) {
-            velocity -= dist * M[2];
-        }
-        if (button_state[button::LEFT]) {
-            velocity -= dist * M[0];
-        }
-        if (button_state[button::RIGHT]) {
-            velocity += dist * M[0];
+    if (input.forward) {
+        p.velocity += dist * M[2];
+    }
+    if (input.backward) {
+        p.velocity -= dist * M[2];
+    }
+    if (input.left) {
+        p.velocity -= dist * M[0];
+    }
+    if (input.right) {
+        p.velocity += dist * M[0];
+    }
+    
+    if (p.airborne) {
+        // Fall
+        p.velocity += GRAVITY;
+    } else {
+        // Jump
+        if (input.jump) {
+            p.velocity += JUMP_SPEED * M[1];
+            p.airborne = true;
         }
-        
-        if (airborne) {
-            // Fall
-            velocity += GRAVITY;
-        } else {
-            // Jump
-            if (button_state[button::JUMP]) {
-                velocity += JUMP_SPEED * M[1];
-                airborne = true;
-            }
-            velocity += ground_vel;
+        p.velocity += p.ground_vel;
+    }
+    
+    // Move
+    if (glm::length(p.velocity)>1e-3 || input.advance) {
+        p.move_counter++;
+        p.position += p.velocity;
+        return true;
+    }
+    return false;
+}
+
+// Applies player input and physics for a single simulation step.
+// The input is read once, as the render thread can change it meanwhile, and the log must match what is simulated.
+void move_player() {
+    logged_input logged = logged_input();
+    for (int i=0; i<button::STATES; i++) {
+        logged.buttons |= button_state[i] << i;
+    }
+    logged.tau = tau;
+    input_log.push_back(logged);
+    
+    if (held(logged, button::REWIND)) {
+        if (!old_position.empty()) {
+            player.position = old_position.back(); old_position.pop_back();
+            player.velocity = old_velocity.back(); old_velocity.pop_back();
+            player.move_counter--;
         }
-        
-        // Move
-        if (glm::length(velocity)>1e-3 || button_state[button::ADVANCE]) {
+    } else {
+        player_input input = decode_input(logged);
+        glm::dvec3 prev_position = player.position;
+        glm::dvec3 prev_velocity = player.velocity;
+        if (step_player(player, input)) {
             // Record history
-            old_position.push_back(position);
+            old_position.push_back(prev_position);
             old_velocity.push_back(prev_velocity);
-            move_counter++;
-
-            // Move
-            position += velocity;
         }
     }
-    
-    // Tilt camera
-    view = glm::rotate(view, phi, M[0]);
-    orientation = glm::dmat3(view);
 } 
 
-void next_frame(int elapsed) {
-    int delay = MILLISECONDS_PER_FRAME-elapsed;
-    if (delay>10) {
-        SDL_Delay(delay);
-    }    
+camera_state get_camera() {
+    camera_state c = {previous_position, player.position};
+    return c;
+}
+
+/** Sets the state used for drawing to lie the given fraction between the previous and current simulation step. */
+void interpolate(const camera_state & camera, double alpha) {
+    interpolation = alpha;
+    camera_position = camera.previous_position + (camera.position - camera.previous_position) * alpha;
 }
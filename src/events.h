@@ -19,19 +19,87 @@
 #ifndef EVENTS_H
 #define EVENTS_H
 #include <glm/glm.hpp>
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include "point_types.h"
 
-void handle_events();
-void next_frame(int elapsed);
-void reset(glm::dvec3 start_position);
+/** Duration of a single simulation step. The physics constants are tuned for this. */
+static const int MILLISECONDS_PER_STEP = 33;
+
+/** The physics state of a player. */
+struct player_state {
+    glm::dvec3 position;
+    glm::dvec3 velocity;
+    glm::dvec3 ground_vel;
+    bool airborne;
+    uint move_counter;
+};
+
+/** The buttons a player holds during a step and the direction they are facing. */
+struct player_input {
+    bool forward, backward, left, right, jump, advance;
+    double tau;
+};
+
+/** 
+ * The input of a single simulation step, as stored in the input log that is saved next to a record. 
+ * The log starts when the level is (re)started, such that the run can be verified by replaying it.
+ */
+struct logged_input {
+    uint32_t buttons;
+    uint32_t padding;
+    double tau;
+};
+
+/** The part of the player state that is needed to draw a frame. */
+struct camera_state {
+    glm::dvec3 previous_position;
+    glm::dvec3 position;
+};
+
+/** The buttons that control the player. */
+class button {
+    public:
+    enum {
+        FORWARD, BACKWARD, LEFT, RIGHT, 
+        JUMP, ADVANCE, REWIND, 
+        
+        STATES
+    };
+};
+
+/** Handles the pending events of the window. Returns true if any of them was player input. */
+bool handle_events();
+/** Sets whether a button is held. The events are handled on the render thread, the buttons are read by the simulation. */
+void set_button(int b, bool state);
+/** Turns the camera by the given angles, keeping it between looking straight up and straight down. */
+void turn_camera(double dtau, double dphi);
+/** Sets the orientation used for drawing from the camera angles. */
+void orient_camera();
+void begin_step();
+void move_player();
+/** Applies input, drag and gravity to a player and moves it. Returns true if the player moved. */
+bool step_player(player_state & p, const player_input & input);
+camera_state get_camera();
+void interpolate(const camera_state & camera, double alpha);
+void reset(glm::dvec3 start_position, const char * map_file);
 void finish(glm::dvec3 end_position, const char * target_file);
+/** Makes the next move_player() use the given input, to replay a run. */
+void replay_input(const logged_input & input);
+/** Reads an input log and the map it was recorded on. */
+bool read_input_log(const char * filename, char * map_file, size_t map_file_size, std::vector<logged_input> & inputs);
+
+/** If set, finish() passes the record to this function instead of saving it. */
+extern void (*record_hook)(const std::vector<point3f> & record);
 
-extern bool quit;
-extern bool reload;
-extern bool airborne;
-extern glm::dvec3 ground_vel;
+extern std::atomic<bool> quit;
+extern std::atomic<bool> reload;
+extern std::atomic<bool> restart;
+extern player_state player;
 extern glm::dmat3 orientation;
-extern glm::dvec3 position;
-extern glm::dvec3 velocity;
-extern uint move_counter;
+extern double interpolation;
+extern glm::dvec3 camera_position;
 
 #endif
@@ -0,0 +1,99 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2013,2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <SDL/SDL.h>
+
+#include "events.h"
+#include "keymap.h"
+
+static const double ROTATE_SPEED =  0.01;
+
+static bool mousemove=false;
+
+// checks user input
+bool handle_events() {
+    SDL_Event event;
+    bool input = false;
+
+    /* Check for events */
+    while (SDL_PollEvent (&event)) {
+        switch (event.type) {
+        case SDL_KEYUP:
+        case SDL_KEYDOWN: {
+            bool state = (event.type == SDL_KEYDOWN);
+            input = true;
+            switch (event.key.keysym.sym) {
+                case SDLK_ESCAPE:
+                    quit = true;
+                    break;
+                case SDLK_F5:
+                    reload = true;
+                    break;
+                case KEY_RESTART:
+                    if (state) restart = true;
+                    break;
+                case KEY_FORWARD:
+                    set_button(button::FORWARD, state);
+                    break;
+                case KEY_BACKWARD:
+                    set_button(button::BACKWARD, state);
+                    break;
+                case KEY_LEFT:
+                    set_button(button::LEFT, state);
+                    break;
+                case KEY_RIGHT:
+                    set_button(button::RIGHT, state);
+                    break;
+                case KEY_JUMP:
+                    set_button(button::JUMP, state);
+                    break;
+                case KEY_ADVANCE:
+                    set_button(button::ADVANCE, state);
+                    break;
+                case KEY_REWIND:
+                    set_button(button::REWIND, state);
+                    break;
+                default:
+                    break;
+            }
+            break;
+        }
+        case SDL_MOUSEBUTTONDOWN: {
+            SDL_ShowCursor(mousemove);
+            mousemove=!mousemove;
+            SDL_WM_GrabInput(mousemove?SDL_GRAB_ON:SDL_GRAB_OFF);
+            break;
+        }
+        case SDL_MOUSEMOTION: {
+            if (mousemove) {
+                turn_camera(-event.motion.xrel*ROTATE_SPEED, -event.motion.yrel*ROTATE_SPEED);
+                input = true;
+            }
+            break;
+        }
+        case SDL_QUIT:
+            quit = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    orient_camera();
+    return input;
+}
@@ -0,0 +1,175 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+#include "jobs.h"
+
+namespace {
+    struct job {
+        const std::function<void(unsigned int, unsigned int)> * body;
+        std::atomic<unsigned int> remaining;
+    };
+    
+    struct task {
+        job * parent;
+        unsigned int begin, end;
+    };
+    
+    struct task_queue {
+        std::mutex lock;
+        std::deque<task> tasks;
+    };
+}
+
+static std::vector<std::thread> threads;
+static task_queue * queues = NULL;
+static unsigned int queue_count = 0;
+static std::atomic<bool> running(false);
+// Number of tasks that are queued and not yet taken.
+static std::atomic<unsigned int> queued(0);
+static std::mutex sleep_lock;
+static std::condition_variable wake;
+// Queue owned by the current thread, or -1 if it is not a worker.
+static thread_local int own_queue = -1;
+
+// Takes the most recently queued task, which is likely to use data that is still in cache.
+static bool pop(unsigned int q, task & t) {
+    std::lock_guard<std::mutex> l(queues[q].lock);
+    if (queues[q].tasks.empty()) return false;
+    t = queues[q].tasks.back();
+    queues[q].tasks.pop_back();
+    return true;
+}
+
+// Takes the oldest task from another queue.
+static bool steal(unsigned int q, task & t) {
+    std::lock_guard<std::mutex> l(queues[q].lock);
+    if (queues[q].tasks.empty()) return false;
+    t = queues[q].tasks.front();
+    queues[q].tasks.pop_front();
+    return true;
+}
+
+static bool find_task(task & t) {
+    unsigned int first = 0;
+    if (own_queue >= 0) {
+        if (pop(own_queue, t)) return true;
+        first = own_queue + 1;
+    }
+    for (unsigned int i=0; i<queue_count; i++) {
+        if (steal((first + i) % queue_count, t)) return true;
+    }
+    return false;
+}
+
+static void run(const task & t) {
+    queued--;
+    (*t.parent->body)(t.begin, t.end);
+    // This must be the last access, as the job is destroyed once all its tasks are done.
+    t.parent->remaining--;
+}
+
+static void work(unsigned int index) {
+    own_queue = index;
+    while (running) {
+        task t;
+        if (find_task(t)) {
+            run(t);
+            continue;
+        }
+        std::unique_lock<std::mutex> l(sleep_lock);
+        wake.wait(l, []{ return queued > 0 || !running; });
+    }
+}
+
+void jobs::start(unsigned int workers) {
+    stop();
+    if (workers == 0) {
+        unsigned int cores = std::thread::hardware_concurrency();
+        workers = cores > 1 ? cores - 1 : 0;
+    }
+    if (workers == 0) return;
+    queue_count = workers;
+    queues = new task_queue[workers];
+    running = true;
+    for (unsigned int i=0; i<workers; i++) {
+        threads.push_back(std::thread(work, i));
+    }
+}
+
+void jobs::stop() {
+    if (threads.empty()) return;
+    {
+        std::lock_guard<std::mutex> l(sleep_lock);
+        running = false;
+    }
+    wake.notify_all();
+    for (std::thread & t : threads) t.join();
+    threads.clear();
+    delete[] queues;
+    queues = NULL;
+    queue_count = 0;
+}
+
+unsigned int jobs::workers() {
+    return queue_count;
+}
+
+void jobs::parallel_for(unsigned int n, unsigned int grain, const std::function<void(unsigned int, unsigned int)> & body) {
+    if (n == 0) return;
+    if (queue_count == 0 || n <= grain) {
+        body(0, n);
+        return;
+    }
+    unsigned int chunks = (n + grain - 1) / grain;
+    job j;
+    j.body = &body;
+    j.remaining = chunks;
+    
+    {
+        std::lock_guard<std::mutex> l(sleep_lock);
+        queued += chunks;
+    }
+    
+    // Spread the ranges over the queues, starting with our own.
+    unsigned int first = own_queue >= 0 ? own_queue : 0;
+    for (unsigned int c=0; c<chunks; c++) {
+        task t = {&j, c*grain, std::min(n, (c+1)*grain)};
+        task_queue & q = queues[(first + c) % queue_count];
+        std::lock_guard<std::mutex> l(q.lock);
+        q.tasks.push_back(t);
+    }
+    wake.notify_all();
+    
+    // Help until all ranges are done.
+    while (j.remaining > 0) {
+        task t;
+        if (find_task(t)) {
+            run(t);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
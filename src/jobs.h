@@ -0,0 +1,41 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef JOBS_H
+#define JOBS_H
+#include <functional>
+
+/**
+ * A small work-stealing task scheduler with a fixed pool of worker threads. 
+ * Each worker has its own queue of tasks and steals from the others when it runs out.
+ * Threads that wait for a parallel_for execute tasks as well.
+ * Until start() is called, parallel_for runs on the calling thread.
+ */
+namespace jobs {
+    /** Starts the given number of workers, or one less than the number of cores if 0. */
+    void start(unsigned int workers = 0);
+    void stop();
+    unsigned int workers();
+    /** 
+     * Calls body(begin, end) for consecutive ranges of at most grain elements covering [0, n), and 
+     * returns when all of them are done. To be deterministic, the ranges must write to disjoint data.
+     */
+    void parallel_for(unsigned int n, unsigned int grain, const std::function<void(unsigned int, unsigned int)> & body);
+};
+
+#endif
@@ -12,6 +12,7 @@
 # define KEY_JUMP     SDLK_SPACE
 # define KEY_ADVANCE  SDLK_LSHIFT
 # define KEY_REWIND   SDLK_LCTRL
+# define KEY_RESTART  SDLK_r
 #endif
 
 #if KEYBOARD == DVORAK
@@ -22,4 +23,5 @@
 # define KEY_JUMP     SDLK_SPACE
 # define KEY_ADVANCE  SDLK_LSHIFT
 # define KEY_REWIND   SDLK_LCTRL
+# define KEY_RESTART  SDLK_p
 #endif
\ No newline at end of file
@@ -22,7 +22,16 @@ glm::dvec3 luaX_get_vector(lua_State * L) {
     return r;
 }
 
-static char read_buffer[1024];
+void luaX_push_vector(lua_State * L, const glm::dvec3 & v) {
+    lua_createtable(L, 3, 0);
+    for (int i=0; i<3; i++) {
+        lua_pushnumber(L, v[i]);
+        lua_rawseti(L, -2, i+1);
+    }
+}
+
+// Per thread, as maps can be loaded in the background.
+static thread_local char read_buffer[1024];
 static const char* read_physfs_file(lua_State *, void* data, size_t* size) {
     PHYSFS_File * script = (PHYSFS_File*)data;
     *size = PHYSFS_read(script, read_buffer, 1, 1024);
@@ -54,6 +63,60 @@ bool luaX_execute_script(lua_State * L, const char * physfs_filename)
     return true;
 }
 
+// Pushes the table of global variables.
+static void push_globals(lua_State * L) {
+#ifdef USE_LUAJIT
+    lua_pushvalue(L, LUA_GLOBALSINDEX);
+#else
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+#endif
+}
+
+const char * luaX_backend() {
+#ifdef USE_LUAJIT
+    return LUAJIT_VERSION;
+#else
+    return LUA_RELEASE;
+#endif
+}
+
+/**
+ * Copies the global variables that hold a number, string or boolean into a new table.
+ * Returns a registry reference to this table.
+ */
+int luaX_snapshot_globals(lua_State * L) {
+    lua_newtable(L);
+    push_globals(L);
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+        int type = lua_type(L, -1);
+        if (type == LUA_TNUMBER || type == LUA_TSTRING || type == LUA_TBOOLEAN) {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, -5);
+        } else {
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+    return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+/**
+ * Assigns the values stored by luaX_snapshot_globals to the global variables.
+ */
+void luaX_restore_globals(lua_State * L, int snapshot) {
+    push_globals(L);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, snapshot);
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, -5);
+    }
+    lua_pop(L, 2);
+}
+
 static int math_hypot(lua_State * L) {
     luaL_argcheck(L, lua_isnumber(L, 1), 1, "Argument must be a number");
     luaL_argcheck(L, lua_isnumber(L, 2), 2, "Argument must be a number");
@@ -4,10 +4,31 @@
 #include <glm/glm.hpp>
 struct lua_State;
 
+#ifdef USE_LUAJIT
+#include <lua.hpp>
+// LuaJIT implements the API of Lua 5.1, with part of 5.2. These provide what is used of 5.3.
+#define luaL_len(L, index) ((int)lua_objlen(L, index))
+#define lua_load(L, reader, data, name, mode) lua_loadx(L, reader, data, name, mode)
+inline void luaL_requiref(lua_State * L, const char * name, lua_CFunction open, int global) {
+    lua_pushcfunction(L, open);
+    lua_pushstring(L, name);
+    lua_call(L, 1, 1);
+    if (global) {
+        lua_pushvalue(L, -1);
+        lua_setglobal(L, name);
+    }
+}
+#endif
+
 
 bool luaX_check_field(lua_State * L, int index, const char * field);
 glm::dvec3 luaX_get_vector(lua_State * L);
+void luaX_push_vector(lua_State * L, const glm::dvec3 & v);
 bool luaX_execute_script(lua_State * L, const char * physfs_filename);
 void luaX_open_math_ext(lua_State * L);
+int luaX_snapshot_globals(lua_State * L);
+void luaX_restore_globals(lua_State * L, int snapshot);
+/** Name and version of the Lua implementation that runs the map scripts. */
+const char * luaX_backend();
 
 #endif
@@ -20,11 +20,66 @@
 #include <physfs.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 
 #include "art.h"
 #include "events.h"
 #include "timing.h"
 #include "scene.h"
+#include "jobs.h"
+#include "spectate.h"
+#include "occlusion.h"
+#include "scenery/grid.h"
+
+// Maximum amount of simulation that is done at once to catch up.
+static const double MAX_CATCH_UP = 250;
+// Time between printing thread timings, in milliseconds.
+static const double TIMING_REPORT_PERIOD = 5000;
+
+static Timer game_clock;
+static ThreadTiming simulation_timing("simulation");
+static ThreadTiming render_timing("render    ");
+static SampleStats frame_stats("frame time   ");
+static SampleStats latency_stats("input latency");
+
+// Time at which input was received that no simulation step has used yet, or -1.
+static std::atomic<double> pending_input(-1);
+// Time at which the oldest input used by the most recently published step was received, or -1.
+static std::atomic<double> published_input(-1);
+
+// Keeps the oldest time, as that is the input that waited the longest.
+static void mark_input(std::atomic<double> & target, double time) {
+    double expected = -1;
+    target.compare_exchange_strong(expected, time);
+}
+
+// Runs the simulation at a fixed rate until the game quits.
+static void simulate() {
+    double simulated = game_clock.elapsed();
+    while (!quit) {
+        double now = game_clock.elapsed();
+        if (now - simulated > MAX_CATCH_UP) {
+            // Skip time lost to stalls, rather than speeding up the game.
+            simulated = now - MILLISECONDS_PER_STEP;
+        }
+        while (simulated + MILLISECONDS_PER_STEP <= now) {
+            Timer t;
+            double input = pending_input.exchange(-1);
+            begin_step();
+            scene::interact();
+            //printf("%6.3lf %6.3lf %6.3lf\n", player.velocity.x, player.velocity.y, player.velocity.z);
+            move_player();
+            simulated += MILLISECONDS_PER_STEP;
+            scene::publish(simulated);
+            spectate::tick();
+            if (input >= 0) mark_input(published_input, input);
+            simulation_timing.add(t.elapsed());
+        }
+        game_clock.sleep_until(simulated + MILLISECONDS_PER_STEP);
+    }
+}
 
 static bool select_paths() {
     char path[1024]; path[1023]=0;
@@ -66,40 +121,93 @@ int main (int argc, char *argv[]) {
         return 1;
     }
     
-    // Open initial map
-    if (argc==2) {
-        if (strcmp(argv[1],"-h")==0 || strcmp(argv[1],"--help")==0) {
-            printf("Usage: %s [initial_map]\n", argv[0]);
-            return 1;
-        }
-        char next[80];
-        snprintf(next, 80, "maps/%s", argv[1]);
-        if (!scene::load(next)) {
-            fprintf(stderr, "Failed to load map '%s'\n", argv[1]);
-            return 1;
-        }
-    } else {
-        if (!scene::load("maps/lvl_0000.map")) {
-            fprintf(stderr, "Failed to load initial map.\n");
+    // Parse arguments
+    const char * initial_map = "lvl_0000.map";
+    bool show_timings = false;
+    int target_fps = 0;
+    const char * spectator_socket = NULL;
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i],"-h")==0 || strcmp(argv[i],"--help")==0) {
+            printf("Usage: %s [--timings] [--fps N] [--grid-radius N] [--no-occlusion] [--spectate socket] [initial_map]\n", argv[0]);
             return 1;
+        } else if (strcmp(argv[i],"--timings")==0) {
+            show_timings = true;
+        } else if (strcmp(argv[i],"--fps")==0 && i+1<argc) {
+            target_fps = atoi(argv[++i]);
+        } else if (strcmp(argv[i],"--grid-radius")==0 && i+1<argc) {
+            grid_radius = std::min(std::max(atoi(argv[++i]), 1), 4096);
+        } else if (strcmp(argv[i],"--no-occlusion")==0) {
+            occlusion::enabled = false;
+        } else if (strcmp(argv[i],"--spectate")==0 && i+1<argc) {
+            spectator_socket = argv[++i];
+        } else {
+            initial_map = argv[i];
         }
     }
     
+    jobs::start();
+    
+    // Open initial map
+    char next[80];
+    snprintf(next, 80, "maps/%s", initial_map);
+    if (!scene::load(next)) {
+        fprintf(stderr, "Failed to load map '%s'\n", initial_map);
+        return 1;
+    }
+    
+    if (spectator_socket && !spectate::start(spectator_socket)) {
+        return 1;
+    }
+    
     init_screen("blockgame");  
     
     // mainloop
+    // The simulation runs at a fixed rate on its own thread, while this thread handles 
+    // the events and draws the most recent simulation step, interpolating from the one before.
+    scene::publish(game_clock.elapsed());
+    std::thread simulation(simulate);
+    double last_report = game_clock.elapsed();
+    double next_frame = last_report;
+    double last_present = -1;
     while (!quit) {
+        if (target_fps > 0) {
+            next_frame += 1000.0 / target_fps;
+            if (next_frame < game_clock.elapsed()) {
+                // Behind schedule, hence do not try to catch up.
+                next_frame = game_clock.elapsed();
+            } else {
+                game_clock.sleep_until(next_frame);
+            }
+        }
+        // Input is handled right before drawing, such that it is as recent as possible.
+        if (handle_events()) mark_input(pending_input, game_clock.elapsed());
+        double input = published_input.exchange(-1);
         Timer t;
-        scene::interact();
-        //printf("%6.3lf %6.3lf %6.3lf\n", velocity.x, velocity.y, velocity.z);
+        double now = game_clock.elapsed();
+        scene::prepare_frame(now);
         clear_screen();
         set_matrix();
         scene::draw();
+        render_timing.add(t.elapsed());
         flip_screen();
-        next_frame(t.elapsed());
-        handle_events();
+        
+        double present = game_clock.elapsed();
+        if (input >= 0) latency_stats.add(present - input);
+        if (last_present >= 0) frame_stats.add(present - last_present);
+        last_present = present;
+        if (show_timings && now - last_report >= TIMING_REPORT_PERIOD) {
+            simulation_timing.report(now - last_report);
+            render_timing.report(now - last_report);
+            frame_stats.report();
+            latency_stats.report();
+            if (occlusion::enabled) occlusion::report();
+            last_report = now;
+        }
     }
+    simulation.join();
+    spectate::stop();
     scene::unload();
+    jobs::stop();
     
     return 0;
 }
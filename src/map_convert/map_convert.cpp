@@ -3,7 +3,11 @@
 #include <string>
 #include <fstream>
 #include <iomanip>
-#include "filemap.h"
+#include <climits>
+#include <cstdlib>
+#include <physfs.h>
+#include "../filemap.h"
+#include "../scene.h"
 
 static const double GEM_HEIGHT = 0.4; 
 
@@ -78,11 +82,36 @@ std::ostream& operator<<(std::ostream& o, const place_block &b) {
 };
 
 /**
- * Program to convert the legacy maps into lua format.
+ * Executes a map script and stores the resulting scenery as a baked map.
+ * If a cell size is given, only the static blocks are stored, as a cell file that can be streamed.
+ */
+int bake_map(const char * argv0, const char * input, const char * output, float cell_size = 0) {
+    char script[256];
+    if (!scene::mount_map_file(argv0, input, script, sizeof(script))) return 1;
+    bool ok = cell_size > 0 ? scene::bake_cells(script, output, cell_size) : scene::bake(script, output);
+    PHYSFS_deinit();
+    return ok?0:1;
+}
+
+/**
+ * Program to convert the legacy maps into lua format, or map scripts into baked maps.
  */
 int main(int argc, const char ** argv) {
+    if (argc==4 && strcmp(argv[1], "bake")==0) {
+        return bake_map(argv[0], argv[2], argv[3]);
+    }
+    if ((argc==4 || argc==5) && strcmp(argv[1], "cells")==0) {
+        float cell_size = argc==5 ? atof(argv[4]) : 32;
+        if (cell_size <= 0) {
+            fprintf(stderr, "Invalid cell size '%s'\n", argv[4]);
+            return 1;
+        }
+        return bake_map(argv[0], argv[2], argv[3], cell_size);
+    }
     if (argc!=3) {
         printf("Usage: %s inputfile outputfile\n", argv[0]);
+        printf("       %s bake mapscript bakedmap\n", argv[0]);
+        printf("       %s cells mapscript cellfile [cell_size]\n", argv[0]);
         return 1;
     }
     std::ofstream out(argv[2]);
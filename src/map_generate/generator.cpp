@@ -0,0 +1,116 @@
+#include <cstdio>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "../point_types.h"
+#include "../xorshift.h"
+#include "generator.h"
+
+// Spacing between the blocks on the grid.
+static const double SPACING = 4;
+
+stress_map default_stress_map() {
+    stress_map m = {1, 1000, 100, 10, 10, 5, 5, 1000};
+    return m;
+}
+
+// Places the items on a square grid, which is large enough for all of them.
+struct grid_layout {
+    int side;
+    int next;
+    grid_layout(int items) : side(std::max(1, (int)std::ceil(std::sqrt((double)items)))), next(0) {}
+    void position(double & x, double & z) {
+        x = (next % side - side/2) * SPACING;
+        z = (next / side - side/2) * SPACING;
+        next++;
+    }
+};
+
+static bool write_ghost(const char * filename, xorshift & random, double x, double z, int length) {
+    std::vector<point3f> record(length);
+    double y = 3;
+    for (int i=0; i<length; i++) {
+        x += random.uniform(-0.2, 0.2);
+        z += random.uniform(-0.2, 0.2);
+        y = std::max(1.0, y + random.uniform(-0.1, 0.1));
+        point3f p = {(float)x, (float)y, (float)z};
+        record[i] = p;
+    }
+    FILE * f = fopen(filename, "wb");
+    if (!f) {
+        perror("Could not write record");
+        return false;
+    }
+    bool ok = fwrite(record.data(), sizeof(point3f), length, f) == (size_t)length;
+    fclose(f);
+    return ok;
+}
+
+bool generate_map(const stress_map & m, const char * dir, const char * name, const char * records_dir) {
+    char filename[1024];
+    snprintf(filename, sizeof(filename), "%s/%s.map", dir, name);
+    FILE * f = fopen(filename, "w");
+    if (!f) {
+        perror("Could not write map");
+        return false;
+    }
+    xorshift random(m.seed);
+    int blocks = m.static_blocks + m.rotated_blocks + m.objects * m.object_blocks;
+    grid_layout grid(m.static_blocks + m.rotated_blocks + m.objects + m.gems + m.ghosts);
+    
+    fprintf(f, "-- Generated stress map: seed %u, %d static blocks, %d rotated blocks, %d objects of %d blocks, %d gems, %d ghosts\n",
+        m.seed, m.static_blocks, m.rotated_blocks, m.objects, m.object_blocks, m.gems, m.ghosts);
+    fprintf(f, "reserve_blocks(%d)\n", blocks);
+    double x, z;
+    for (int i=0; i<m.static_blocks; i++) {
+        grid.position(x, z);
+        fprintf(f, "place_block({pos={%.3f,%.3f,%.3f}, size={%.3f,%.3f,%.3f}, color=0x%06x, static=true})\n",
+            x, random.uniform(0, 2), z, random.uniform(0.5, 1.5), random.uniform(0.2, 1), random.uniform(0.5, 1.5), random.next() & 0xffffff);
+    }
+    for (int i=0; i<m.rotated_blocks; i++) {
+        grid.position(x, z);
+        fprintf(f, "block = place_block({pos={%.3f,%.3f,%.3f}, size={%.3f,%.3f,%.3f}, color=0x%06x, static=true}); ",
+            x, random.uniform(0, 2), z, random.uniform(0.5, 1.5), random.uniform(0.2, 1), random.uniform(0.5, 1.5), random.next() & 0xffffff);
+        fprintf(f, "rotate_block(block, {angle=%.4f, axis={%.3f,1,%.3f}})\n", 
+            random.uniform(0, 2*M_PI), random.uniform(-0.5, 0.5), random.uniform(-0.5, 0.5));
+    }
+    
+    fprintf(f, "objects = {}\n");
+    for (int i=0; i<m.objects; i++) {
+        grid.position(x, z);
+        fprintf(f, "list = {}\n");
+        for (int j=0; j<m.object_blocks; j++) {
+            double angle = 2*M_PI*j/m.object_blocks;
+            fprintf(f, "list[%d] = place_block({pos={%.3f,1,%.3f}, size={0.5,0.2,0.5}, color=0x%06x})\n",
+                j+1, x + std::cos(angle)*1.5, z + std::sin(angle)*1.5, random.next() & 0xffffff);
+        }
+        fprintf(f, "objects[%d] = {create_object(list, {%.3f,1,%.3f}), %.4f}\n", i+1, x, z, random.uniform(-0.05, 0.05));
+    }
+    
+    for (int i=0; i<m.gems; i++) {
+        grid.position(x, z);
+        fprintf(f, "place_gem({pos={%.3f,%.3f,%.3f}})\n", x, random.uniform(2, 4), z);
+    }
+    for (int i=0; i<m.ghosts; i++) {
+        grid.position(x, z);
+        char record[1024];
+        snprintf(record, sizeof(record), "%s/%s_%d.rec", records_dir, name, i);
+        if (!write_ghost(record, random, x, z, m.ghost_length)) {
+            fclose(f);
+            return false;
+        }
+        fprintf(f, "place_gem({pos={%.3f,3,%.3f}, record=\"%s_%d.rec\"})\n", x, z, name, i);
+    }
+    
+    fprintf(f, "function tick(n)\n");
+    fprintf(f, "  for i,o in ipairs(objects) do\n");
+    fprintf(f, "    rotate_object(o[1], {angle=n*o[2], axis={0,1,0}, reset=1})\n");
+    fprintf(f, "    update_object(o[1])\n");
+    fprintf(f, "  end\n");
+    fprintf(f, "end\n");
+    fprintf(f, "set_start({0,4,0})\n");
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
@@ -0,0 +1,28 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <cstdint>
+
+/** The contents of a generated stress map. The same settings always give the same map. */
+struct stress_map {
+    uint32_t seed;
+    int static_blocks;
+    int rotated_blocks;
+    /** Objects that rotate every tick, each consisting of object_blocks blocks. */
+    int objects;
+    int object_blocks;
+    int gems;
+    /** Gems that show a recorded run of ghost_length steps. */
+    int ghosts;
+    int ghost_length;
+};
+
+stress_map default_stress_map();
+
+/** 
+ * Writes the map script <dir>/<name>.map and the records of its ghosts, which are 
+ * named <name>_<n>.rec, to records_dir.
+ */
+bool generate_map(const stress_map & m, const char * dir, const char * name, const char * records_dir);
+
+#endif
@@ -0,0 +1,89 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <physfs.h>
+#include "../scene.h"
+#include "generator.h"
+
+static void usage(const char * argv0) {
+    printf("Usage: %s [options] directory name\n", argv0);
+    printf("Writes directory/name.map and the records of its ghosts. Options:\n");
+    printf("  --seed N             seed of the random generator (1)\n");
+    printf("  --static N           static blocks (1000)\n");
+    printf("  --rotated N          rotated blocks (100)\n");
+    printf("  --objects N          rotating objects (10)\n");
+    printf("  --object-blocks N    blocks per object (10)\n");
+    printf("  --gems N             gems (5)\n");
+    printf("  --ghosts N           gems with a recorded run (5)\n");
+    printf("  --ghost-length N     steps in each recorded run (1000)\n");
+    printf("  --records DIR        directory for the records (directory)\n");
+    printf("  --bake               also write directory/name.baked\n");
+    printf("  --cells SIZE         also write the static blocks to directory/name.cells\n");
+}
+
+/**
+ * Generates maps of configurable size for scaling tests.
+ */
+int main(int argc, const char ** argv) {
+    stress_map m = default_stress_map();
+    const char * records = NULL;
+    bool bake = false;
+    float cell_size = 0;
+    int i = 1;
+    for (; i+1<argc && strncmp(argv[i], "--", 2)==0; i++) {
+        const char * option = argv[i];
+        if (strcmp(option, "--bake")==0) {
+            bake = true;
+            continue;
+        }
+        if (i+2 >= argc) break;
+        const char * value = argv[++i];
+        if      (strcmp(option, "--seed")==0)          m.seed = strtoul(value, NULL, 10);
+        else if (strcmp(option, "--static")==0)        m.static_blocks = atoi(value);
+        else if (strcmp(option, "--rotated")==0)       m.rotated_blocks = atoi(value);
+        else if (strcmp(option, "--objects")==0)       m.objects = atoi(value);
+        else if (strcmp(option, "--object-blocks")==0) m.object_blocks = atoi(value);
+        else if (strcmp(option, "--gems")==0)          m.gems = atoi(value);
+        else if (strcmp(option, "--ghosts")==0)        m.ghosts = atoi(value);
+        else if (strcmp(option, "--ghost-length")==0)  m.ghost_length = atoi(value);
+        else if (strcmp(option, "--records")==0)       records = value;
+        else if (strcmp(option, "--cells")==0)         cell_size = atof(value);
+        else {
+            fprintf(stderr, "Unknown option '%s'\n", option);
+            return 1;
+        }
+    }
+    if (i+2 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char * dir = argv[i];
+    const char * name = argv[i+1];
+    if (!records) records = dir;
+    if (!generate_map(m, dir, name, records)) return 1;
+    printf("Wrote %s/%s.map\n", dir, name);
+    if (!bake && cell_size <= 0) return 0;
+
+    char records_path[PATH_MAX];
+    if (!realpath(records, records_path)) {
+        perror("Could not open records directory");
+        return 1;
+    }
+    char target[PATH_MAX];
+    snprintf(target, sizeof(target), "%s/%s.map", dir, name);
+    char script[256];
+    if (!scene::mount_map_file(argv[0], target, script, sizeof(script))) return 1;
+    PHYSFS_mount(records_path, "/records/", 1);
+    bool ok = true;
+    if (bake) {
+        snprintf(target, sizeof(target), "%s/%s.baked", dir, name);
+        ok = scene::bake(script, target);
+    }
+    if (ok && cell_size > 0) {
+        snprintf(target, sizeof(target), "%s/%s.cells", dir, name);
+        ok = scene::bake_cells(script, target, cell_size);
+    }
+    PHYSFS_deinit();
+    return ok?0:1;
+}
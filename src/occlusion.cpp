@@ -0,0 +1,328 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "occlusion.h"
+#include "timing.h"
+
+bool occlusion::enabled = true;
+
+using occlusion::WIDTH;
+using occlusion::HEIGHT;
+// Blocks whose shortest edge is at least this long are used as occluders.
+static const float OCCLUDER_EDGE = 1.5;
+// Number of occluders rasterized per frame.
+static const unsigned int MAX_OCCLUDERS = 128;
+// Points closer to the camera than this are not projected, as they might be in front of the near plane.
+static const float NEAR_W = 0.1;
+// Margin on the inverse depth, to hide rounding errors of the rasterizer.
+static const float DEPTH_BIAS = 1.001;
+
+// Faces of a block as quads of corner indices.
+static const int box_faces[24] = {
+    1, 0, 2, 3,
+    4, 5, 7, 6,
+    0, 1, 5, 4, 
+    3, 2, 6, 7, 
+    2, 0, 4, 6,
+    1, 3, 7, 5,
+};
+
+// Inverse of the distance to the nearest occluder per pixel, or 0 if nothing was drawn there.
+alignas(32) static float depth[WIDTH * HEIGHT];
+static bool has_occluders;
+static std::vector<std::pair<float, unsigned int>> candidates;
+
+// Totals since the previous report.
+static unsigned long frames, occluders, clusters, occluded;
+static double cull_ms;
+
+struct projected {
+    float x, y, z;
+};
+
+// Projects a point to pixel coordinates and inverse depth. Returns false if it is too close to the camera.
+static bool project(const glm::mat4 & m, const glm::vec3 & p, projected & out) {
+    glm::vec4 c = m * glm::vec4(p, 1);
+    if (c.w < NEAR_W) return false;
+    out.z = 1 / c.w;
+    out.x = (c.x * out.z * 0.5f + 0.5f) * WIDTH;
+    out.y = (c.y * out.z * 0.5f + 0.5f) * HEIGHT;
+    return true;
+}
+
+// Linear function of the pixel coordinates: a*x + b*y + c.
+struct linear {
+    float a, b, c;
+};
+
+// Largest number of edges of the outline of a box, and of faces that face the camera.
+static const int MAX_EDGES = 8;
+static const int MAX_FACES = 6;
+
+// Obtains the inverse depth over the plane through three projected points. Returns false if they are collinear.
+static bool depth_plane(const projected & a, const projected & b, const projected & c, linear & out) {
+    float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    if (std::abs(area) < 1e-6f) return false;
+    float inv = 1 / area;
+    out.a = ((b.y - c.y)*a.z + (c.y - a.y)*b.z + (a.y - b.y)*c.z) * inv;
+    out.b = ((c.x - b.x)*a.z + (a.x - c.x)*b.z + (b.x - a.x)*c.z) * inv;
+    out.c = ((b.x*c.y - b.y*c.x)*a.z + (c.x*a.y - c.y*a.x)*b.z + (a.x*b.y - a.y*b.x)*c.z) * inv;
+    return true;
+}
+
+static float cross(const projected & o, const projected & a, const projected & b) {
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+// Computes the convex hull of the projected corners, counterclockwise. Returns the number of hull points.
+static int outline(const projected * p, projected * hull) {
+    projected s[8];
+    std::copy(p, p+8, s);
+    std::sort(s, s+8, [](const projected & a, const projected & b) {return a.x < b.x || (a.x == b.x && a.y < b.y);});
+    int k = 0;
+    for (int i=0; i<8; i++) {
+        while (k >= 2 && cross(hull[k-2], hull[k-1], s[i]) <= 0) k--;
+        hull[k++] = s[i];
+    }
+    for (int i=6, t=k+1; i>=0; i--) {
+        while (k >= t && cross(hull[k-2], hull[k-1], s[i]) <= 0) k--;
+        hull[k++] = s[i];
+    }
+    return k - 1;
+}
+
+/**
+ * Draws the outline of an occluder into the depth buffer. Only pixels that are covered entirely are drawn,
+ * as a pixel that is partly covered can show what lies behind, for example through a narrow gap between occluders.
+ * Each edge and depth plane is therefore evaluated at the corner of the pixel where it is smallest,
+ * which lies half a pixel from the center along both axes. The depth is the minimum over the front faces,
+ * as the front of a convex box is the farthest of the planes of the faces that face the camera.
+ */
+static void rasterize(const linear * edges, int edge_count, const linear * faces, int face_count, int x0, int x1, int y0, int y1) {
+    linear e[MAX_EDGES], f[MAX_FACES];
+    for (int k=0; k<edge_count; k++) {
+        e[k] = edges[k];
+        e[k].c -= 0.5f * (std::abs(e[k].a) + std::abs(e[k].b));
+    }
+    for (int k=0; k<face_count; k++) {
+        f[k] = faces[k];
+        f[k].c -= 0.5f * (std::abs(f[k].a) + std::abs(f[k].b));
+    }
+#ifdef __SSE2__
+    const __m128 offset = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 ea[MAX_EDGES], fa[MAX_FACES];
+    for (int k=0; k<edge_count; k++) ea[k] = _mm_set1_ps(e[k].a);
+    for (int k=0; k<face_count; k++) fa[k] = _mm_set1_ps(f[k].a);
+#endif
+    for (int y=y0; y<=y1; y++) {
+        float fy = y + 0.5f;
+        float er[MAX_EDGES], fr[MAX_FACES];
+        for (int k=0; k<edge_count; k++) er[k] = e[k].b*fy + e[k].c;
+        for (int k=0; k<face_count; k++) fr[k] = f[k].b*fy + f[k].c;
+        float * row = depth + y*WIDTH;
+        int x = x0;
+#ifdef __SSE2__
+        // Four pixels at a time, computing the same values as the loop below.
+        __m128 ver[MAX_EDGES], vfr[MAX_FACES];
+        for (int k=0; k<edge_count; k++) ver[k] = _mm_set1_ps(er[k]);
+        for (int k=0; k<face_count; k++) vfr[k] = _mm_set1_ps(fr[k]);
+        for (; x+3<=x1; x+=4) {
+            __m128 fx = _mm_add_ps(_mm_set1_ps((float)x), offset);
+            __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ea[0], fx), ver[0]), zero);
+            for (int k=1; k<edge_count; k++) {
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ea[k], fx), ver[k]), zero));
+            }
+            __m128 z = _mm_add_ps(_mm_mul_ps(fa[0], fx), vfr[0]);
+            for (int k=1; k<face_count; k++) {
+                z = _mm_min_ps(z, _mm_add_ps(_mm_mul_ps(fa[k], fx), vfr[k]));
+            }
+            __m128 old = _mm_loadu_ps(row + x);
+            __m128 write = _mm_and_ps(inside, _mm_cmpgt_ps(z, old));
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(write, z), _mm_andnot_ps(write, old)));
+        }
+#endif
+        // Remaining pixels, or all of them without SSE2.
+        for (; x<=x1; x++) {
+            float fx = x + 0.5f;
+            bool inside = true;
+            for (int k=0; k<edge_count; k++) inside = inside && e[k].a*fx + er[k] >= 0;
+            float z = f[0].a*fx + fr[0];
+            for (int k=1; k<face_count; k++) z = std::min(z, f[k].a*fx + fr[k]);
+            row[x] = inside && z > row[x] ? z : row[x];
+        }
+    }
+}
+
+static void add_occluder(const glm::mat4 & m, const glm::vec3 & eye, const point3fc * corners) {
+    glm::vec3 v[8];
+    projected p[8];
+    for (int j=0; j<8; j++) {
+        v[j] = glm::vec3(corners[j].x, corners[j].y, corners[j].z);
+        // Occluders that cross the near plane are skipped, which is conservative.
+        if (!project(m, v[j], p[j])) return;
+    }
+    
+    // Depth planes of the faces that face the camera. Faces seen edge on are included, which is conservative.
+    glm::vec3 center = (v[0] + v[7]) * 0.5f;
+    linear faces[MAX_FACES];
+    int face_count = 0;
+    for (int f=0; f<6; f++) {
+        const int * q = box_faces + f*4;
+        // The first and third corner of a face are opposite.
+        glm::vec3 face = (v[q[0]] + v[q[2]]) * 0.5f;
+        glm::vec3 normal = face - center;
+        glm::vec3 view = eye - face;
+        if (glm::dot(normal, view) < -1e-4f * glm::length(normal) * glm::length(view)) continue;
+        if (depth_plane(p[q[0]], p[q[1]], p[q[2]], faces[face_count])) face_count++;
+    }
+    if (face_count == 0) return;
+    
+    projected hull[9];
+    int n = outline(p, hull);
+    if (n < 3) return;
+    linear edges[MAX_EDGES];
+    float x0 = INFINITY, x1 = -INFINITY, y0 = INFINITY, y1 = -INFINITY;
+    for (int k=0; k<n; k++) {
+        const projected & a = hull[k];
+        const projected & b = hull[k+1];
+        // Positive on the inside, which is to the left of the counterclockwise outline.
+        edges[k].a = a.y - b.y;
+        edges[k].b = b.x - a.x;
+        edges[k].c = a.x*b.y - a.y*b.x;
+        x0 = std::min(x0, a.x);
+        x1 = std::max(x1, a.x);
+        y0 = std::min(y0, a.y);
+        y1 = std::max(y1, a.y);
+    }
+    int px0 = std::max(0, (int)std::floor(x0));
+    int px1 = std::min(WIDTH - 1, (int)std::ceil(x1));
+    int py0 = std::max(0, (int)std::floor(y0));
+    int py1 = std::min(HEIGHT - 1, (int)std::ceil(y1));
+    if (px0 > px1 || py0 > py1) return;
+    rasterize(edges, n, faces, face_count, px0, px1, py0, py1);
+    has_occluders = true;
+}
+
+// The eye is the point that the projection maps to x = y = w = 0.
+static glm::vec3 eye_of(const glm::mat4 & m) {
+    glm::vec3 r0(m[0][0], m[1][0], m[2][0]);
+    glm::vec3 r1(m[0][1], m[1][1], m[2][1]);
+    glm::vec3 r3(m[0][3], m[1][3], m[2][3]);
+    float d0 = m[3][0], d1 = m[3][1], d3 = m[3][3];
+    glm::vec3 c01 = glm::cross(r0, r1), c13 = glm::cross(r1, r3), c30 = glm::cross(r3, r0);
+    return -(d0 * c13 + d1 * c30 + d3 * c01) / glm::dot(r0, c13);
+}
+
+// Returns false if the box is certainly hidden behind the occluders.
+static bool visible(const glm::mat4 & m, const glm::vec3 & lower, const glm::vec3 & upper) {
+    if (!has_occluders) return true;
+    float x0 = INFINITY, x1 = -INFINITY, y0 = INFINITY, y1 = -INFINITY, z = 0;
+    for (int j=0; j<8; j++) {
+        glm::vec3 corner(j&4 ? upper.x : lower.x, j&2 ? upper.y : lower.y, j&1 ? upper.z : lower.z);
+        projected p;
+        if (!project(m, corner, p)) return true;
+        x0 = std::min(x0, p.x);
+        x1 = std::max(x1, p.x);
+        y0 = std::min(y0, p.y);
+        y1 = std::max(y1, p.y);
+        z = std::max(z, p.z);
+    }
+    // Widened by a pixel, as the occluders are only sampled at pixel centers.
+    int px0 = std::max(0, (int)std::floor(x0) - 1);
+    int px1 = std::min(WIDTH - 1, (int)std::ceil(x1) + 1);
+    int py0 = std::max(0, (int)std::floor(y0) - 1);
+    int py1 = std::min(HEIGHT - 1, (int)std::ceil(y1) + 1);
+    // Outside the screen, which is left to the clipping of OpenGL.
+    if (px0 > px1 || py0 > py1) return true;
+    z *= DEPTH_BIAS;
+    for (int y=py0; y<=py1; y++) {
+        const float * row = depth + y*WIDTH;
+        for (int x=px0; x<=px1; x++) {
+            if (row[x] <= z) return true;
+        }
+    }
+    return false;
+}
+
+void occlusion::cull(const point3fc * coordinates, unsigned int blocks, const glm::mat4 & view_projection, 
+        const glm::vec3 & camera, std::vector<unsigned int> & visible_clusters) {
+    Timer t;
+    std::fill(depth, depth + WIDTH*HEIGHT, 0.f);
+    has_occluders = false;
+    
+    // Prefer the blocks that cover the largest part of the screen.
+    candidates.clear();
+    for (unsigned int i=0; i<blocks; i++) {
+        const point3fc * c = coordinates + i*8;
+        glm::vec3 c0(c[0].x, c[0].y, c[0].z);
+        glm::vec3 c7(c[7].x, c[7].y, c[7].z);
+        float edge = std::min(glm::length(glm::vec3(c[4].x, c[4].y, c[4].z) - c0), 
+            std::min(glm::length(glm::vec3(c[2].x, c[2].y, c[2].z) - c0), glm::length(glm::vec3(c[1].x, c[1].y, c[1].z) - c0)));
+        if (edge < OCCLUDER_EDGE) continue;
+        float distance = glm::length((c0 + c7) * 0.5f - camera);
+        candidates.push_back(std::make_pair(-edge / std::max(distance, 1.f), i));
+    }
+    if (candidates.size() > MAX_OCCLUDERS) {
+        std::nth_element(candidates.begin(), candidates.begin() + MAX_OCCLUDERS, candidates.end());
+        candidates.resize(MAX_OCCLUDERS);
+    }
+    glm::vec3 eye = eye_of(view_projection);
+    for (const auto & c : candidates) {
+        add_occluder(view_projection, eye, coordinates + c.second*8);
+    }
+    
+    unsigned int n = (blocks + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    unsigned int hidden = 0;
+    for (unsigned int k=0; k<n; k++) {
+        glm::vec3 lower(INFINITY), upper(-INFINITY);
+        unsigned int end = std::min(blocks, (k+1)*CLUSTER_SIZE) * 8;
+        for (unsigned int j=k*CLUSTER_SIZE*8; j<end; j++) {
+            glm::vec3 p(coordinates[j].x, coordinates[j].y, coordinates[j].z);
+            lower = glm::min(lower, p);
+            upper = glm::max(upper, p);
+        }
+        if (visible(view_projection, lower, upper)) {
+            visible_clusters.push_back(k);
+        } else {
+            hidden++;
+        }
+    }
+    
+    frames++;
+    occluders += candidates.size();
+    clusters += n;
+    occluded += hidden;
+    cull_ms += t.elapsed();
+}
+
+void occlusion::report() {
+    if (frames > 0) {
+        fprintf(stderr, "occlusion    : %5.1lf occluders, %6.1lf of %6.1lf clusters occluded, %5.2lf ms per frame\n",
+            occluders / (double)frames, occluded / (double)frames, clusters / (double)frames, cull_ms / frames);
+    }
+    frames = occluders = clusters = occluded = 0;
+    cull_ms = 0;
+}
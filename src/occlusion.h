@@ -0,0 +1,51 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+#include <vector>
+#include <glm/glm.hpp>
+#include "point_types.h"
+
+/**
+ * Coarse occlusion culling on the CPU. The largest blocks near the camera are rasterized
+ * into a low resolution depth buffer, against which the bounds of clusters of blocks are tested.
+ */
+namespace occlusion {
+    /** Number of consecutive blocks that are culled together. */
+    static const unsigned int CLUSTER_SIZE = 32;
+    /** Resolution of the depth buffer, which has the aspect ratio of the screen. */
+    static const int WIDTH = 128;
+    static const int HEIGHT = 96;
+
+    /** Whether scenery<blocks>::draw culls occluded clusters. */
+    extern bool enabled;
+
+    /**
+     * Appends the clusters that may be visible to the given list. The blocks are given by their 
+     * 8 corners, in the order of cube_coords, and are drawn with the given view projection matrix.
+     */
+    void cull(const point3fc * coordinates, unsigned int blocks, const glm::mat4 & view_projection, 
+        const glm::vec3 & camera, std::vector<unsigned int> & visible);
+
+    /** Prints the average number of occluders and occluded clusters per frame since the previous report. */
+    void report();
+}
+
+#endif
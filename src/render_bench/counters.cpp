@@ -0,0 +1,29 @@
+#include <dlfcn.h>
+#include <GL/gl.h>
+#include "counters.h"
+
+unsigned long counters::draw_calls;
+unsigned long counters::vertices;
+
+void counters::reset() {
+    draw_calls = 0;
+    vertices = 0;
+}
+
+// These definitions take precedence over those of the GL library, which are then called through dlsym.
+typedef void (*draw_arrays_function)(GLenum, GLint, GLsizei);
+typedef void (*draw_elements_function)(GLenum, GLsizei, GLenum, const GLvoid *);
+
+extern "C" void glDrawArrays(GLenum mode, GLint first, GLsizei count) {
+    static draw_arrays_function next = (draw_arrays_function)dlsym(RTLD_NEXT, "glDrawArrays");
+    counters::draw_calls++;
+    counters::vertices += count;
+    next(mode, first, count);
+}
+
+extern "C" void glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid * indices) {
+    static draw_elements_function next = (draw_elements_function)dlsym(RTLD_NEXT, "glDrawElements");
+    counters::draw_calls++;
+    counters::vertices += count;
+    next(mode, count, type, indices);
+}
@@ -0,0 +1,15 @@
+#ifndef RENDER_BENCH_COUNTERS_H
+#define RENDER_BENCH_COUNTERS_H
+
+/** 
+ * Work submitted to OpenGL since the last reset. The draw functions of OpenGL are wrapped,
+ * such that the engine is measured without changing it.
+ */
+namespace counters {
+    extern unsigned long draw_calls;
+    /** Number of vertices, or of indices for indexed draw calls. */
+    extern unsigned long vertices;
+    void reset();
+}
+
+#endif
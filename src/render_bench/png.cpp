@@ -0,0 +1,89 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include "png.h"
+
+// The image data is stored in deflate blocks without compression, such that no library is needed.
+static const uint32_t MAX_STORED_BLOCK = 65535;
+
+static uint32_t crc_table[256];
+
+static bool init_crc_table() {
+    for (uint32_t n=0; n<256; n++) {
+        uint32_t c = n;
+        for (int k=0; k<8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+    return true;
+}
+
+static uint32_t crc(const uint8_t * data, size_t length, uint32_t c = 0xffffffffu) {
+    for (size_t i=0; i<length; i++) c = crc_table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    return c;
+}
+
+static void put32(std::vector<uint8_t> & out, uint32_t v) {
+    out.push_back(v >> 24);
+    out.push_back(v >> 16);
+    out.push_back(v >> 8);
+    out.push_back(v);
+}
+
+static void write_chunk(FILE * f, const char * type, const std::vector<uint8_t> & data) {
+    std::vector<uint8_t> chunk;
+    put32(chunk, data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    put32(chunk, crc(chunk.data() + 4, chunk.size() - 4) ^ 0xffffffffu);
+    fwrite(chunk.data(), 1, chunk.size(), f);
+}
+
+bool write_png(const char * filename, const uint8_t * pixels, int width, int height) {
+    static bool crc_initialized = init_crc_table();
+    (void)crc_initialized;
+    FILE * f = fopen(filename, "wb");
+    if (!f) {
+        perror("Could not write PNG");
+        return false;
+    }
+    static const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, 1, sizeof(signature), f);
+    
+    std::vector<uint8_t> head;
+    put32(head, width);
+    put32(head, height);
+    const uint8_t format[] = {8, 6, 0, 0, 0}; // 8 bits per channel, RGBA, no interlacing.
+    head.insert(head.end(), format, format + sizeof(format));
+    write_chunk(f, "IHDR", head);
+    
+    // Each row starts with filter type 0. PNG stores the top row first.
+    std::vector<uint8_t> raw;
+    size_t stride = width * 4;
+    raw.reserve((stride + 1) * height);
+    for (int y=height-1; y>=0; y--) {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixels + y*stride, pixels + (y+1)*stride);
+    }
+    std::vector<uint8_t> data = {0x78, 0x01};
+    uint32_t a = 1, b = 0;
+    for (uint8_t v : raw) {
+        a = (a + v) % 65521;
+        b = (b + a) % 65521;
+    }
+    for (size_t offset=0; offset<raw.size() || offset==0; offset+=MAX_STORED_BLOCK) {
+        uint32_t length = std::min<size_t>(MAX_STORED_BLOCK, raw.size() - offset);
+        data.push_back(offset + length == raw.size());
+        data.push_back(length);
+        data.push_back(length >> 8);
+        data.push_back(~length);
+        data.push_back(~length >> 8);
+        data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + length);
+    }
+    put32(data, (b << 16) | a);
+    write_chunk(f, "IDAT", data);
+    write_chunk(f, "IEND", std::vector<uint8_t>());
+    bool ok = ferror(f) == 0;
+    fclose(f);
+    return ok;
+}
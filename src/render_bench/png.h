@@ -0,0 +1,11 @@
+#ifndef RENDER_BENCH_PNG_H
+#define RENDER_BENCH_PNG_H
+#include <cstdint>
+
+/** 
+ * Writes RGBA pixels, with the bottom row first as returned by OpenGL, to an uncompressed PNG file. 
+ * Returns false on failure.
+ */
+bool write_png(const char * filename, const uint8_t * pixels, int width, int height);
+
+#endif
@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <physfs.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include "../scene.h"
+#include "../events.h"
+#include "../timing.h"
+#include "../jobs.h"
+#include "../art.h"
+#include "counters.h"
+#include "png.h"
+
+// A point on the camera path, with the same angles as the mouse look of the game.
+struct keyframe {
+    glm::dvec3 position;
+    double tau;
+    double phi;
+};
+
+static void usage(const char * argv0) {
+    printf("Usage: %s [options] mapscript [camera_path]\n", argv0);
+    printf("Draws the map without a window, following the camera path, and prints per frame as CSV\n");
+    printf("the time, the number of draw calls and the number of vertices. Options:\n");
+    printf("  --frames N     number of frames (300)\n");
+    printf("  --png DIR      write the frames as DIR/frame_NNNNN.png\n");
+    printf("  --png-every N  write only every Nth frame (1)\n");
+    printf("The camera path has a line 'x y z tau phi' per keyframe, with the angles in radians.\n");
+    printf("The frames are spread evenly over the keyframes. Without a path the camera circles the start.\n");
+}
+
+static bool read_path(const char * filename, std::vector<keyframe> & path) {
+    FILE * f = fopen(filename, "r");
+    if (!f) {
+        perror("Could not open camera path");
+        return false;
+    }
+    keyframe k;
+    while (fscanf(f, "%lf %lf %lf %lf %lf", &k.position.x, &k.position.y, &k.position.z, &k.tau, &k.phi) == 5) {
+        path.push_back(k);
+    }
+    fclose(f);
+    if (path.empty()) {
+        fprintf(stderr, "Camera path '%s' has no keyframes\n", filename);
+        return false;
+    }
+    return true;
+}
+
+// A circle around the start of the map, looking slightly down.
+static void default_path(std::vector<keyframe> & path) {
+    const int STEPS = 16;
+    for (int i=0; i<=STEPS; i++) {
+        double angle = i * 2 * M_PI / STEPS;
+        keyframe k;
+        k.position = player.position + glm::dvec3(std::sin(angle) * 20, 5, std::cos(angle) * 20);
+        k.tau = angle + M_PI;
+        k.phi = 0.2;
+        path.push_back(k);
+    }
+}
+
+static keyframe sample_path(const std::vector<keyframe> & path, double t) {
+    if (path.size() == 1) return path[0];
+    double p = t * (path.size() - 1);
+    size_t i = std::min((size_t)p, path.size() - 2);
+    double alpha = p - i;
+    keyframe k;
+    k.position = path[i].position + (path[i+1].position - path[i].position) * alpha;
+    k.tau = path[i].tau + (path[i+1].tau - path[i].tau) * alpha;
+    k.phi = path[i].phi + (path[i+1].phi - path[i].phi) * alpha;
+    return k;
+}
+
+// Same as orient_camera() in events.cpp, but with the angles of the camera path.
+static void orient_camera(double tau, double phi) {
+    glm::dmat4 view;
+    view = glm::rotate(view, tau, glm::dvec3(0,1,0));
+    glm::dmat3 M = glm::transpose(glm::dmat3(view));
+    view = glm::rotate(view, phi, M[0]);
+    orientation = glm::dmat3(view);
+}
+
+/**
+ * Measures rendering without a display or GPU, using the offscreen backend.
+ */
+int main(int argc, const char ** argv) {
+    int frames = 300;
+    const char * png_dir = NULL;
+    int png_every = 1;
+    int i = 1;
+    for (; i+1<argc && strncmp(argv[i], "--", 2)==0; i+=2) {
+        if      (strcmp(argv[i], "--frames")==0)    frames = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "--png")==0)       png_dir = argv[i+1];
+        else if (strcmp(argv[i], "--png-every")==0) png_every = std::max(1, atoi(argv[i+1]));
+        else {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+    if (i >= argc || i+2 < argc || frames <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char script[256];
+    if (!scene::mount_map_file(argv[0], argv[i], script, sizeof(script))) return 1;
+    jobs::start();
+    if (!scene::load(script)) {
+        fprintf(stderr, "Failed to load map '%s'\n", argv[i]);
+        jobs::stop();
+        PHYSFS_deinit();
+        return 1;
+    }
+    std::vector<keyframe> camera_path;
+    if (i+1 < argc) {
+        if (!read_path(argv[i+1], camera_path)) {
+            scene::unload();
+            jobs::stop();
+            PHYSFS_deinit();
+            return 1;
+        }
+    } else {
+        default_path(camera_path);
+    }
+
+    init_screen(script);
+    SampleStats frame_stats("frame time   ");
+    unsigned long total_calls = 0, total_vertices = 0;
+    std::vector<uint8_t> pixels;
+    bool ok = true;
+    printf("frame,ms,draw_calls,vertices\n");
+    for (int f=0; f<frames; f++) {
+        // The scene is stepped, such that its tick function runs, but the camera follows the path.
+        keyframe k = sample_path(camera_path, frames > 1 ? f / (double)(frames - 1) : 0);
+        begin_step();
+        scene::interact();
+        player.position = k.position;
+        player.velocity = glm::dvec3();
+        double time = f * MILLISECONDS_PER_STEP;
+        scene::publish(time);
+        orient_camera(k.tau, k.phi);
+
+        counters::reset();
+        Timer t;
+        scene::prepare_frame(time + MILLISECONDS_PER_STEP);
+        clear_screen();
+        set_matrix();
+        scene::draw();
+        flip_screen();
+        double ms = t.elapsed();
+        frame_stats.add(ms);
+        total_calls += counters::draw_calls;
+        total_vertices += counters::vertices;
+        printf("%d,%.3lf,%lu,%lu\n", f, ms, counters::draw_calls, counters::vertices);
+
+        if (png_dir && f % png_every == 0) {
+            char png[PATH_MAX];
+            snprintf(png, sizeof(png), "%s/frame_%05d.png", png_dir, f);
+            read_screen(pixels);
+            if (!write_png(png, pixels.data(), SCREEN_WIDTH, SCREEN_HEIGHT)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    frame_stats.report();
+    fprintf(stderr, "draw calls   : %.1lf per frame, %.0lf vertices per frame\n", total_calls / (double)frames, total_vertices / (double)frames);
+
+    scene::unload();
+    jobs::stop();
+    PHYSFS_deinit();
+    return ok ? 0 : 1;
+}
@@ -19,25 +19,82 @@
 #include <lua.hpp>
 #include <physfs.h>
 #include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <thread>
+#include <algorithm>
 
 #include "scene.h"
 #include "events.h"
 #include "scenery/scenery.h"
 #include "scenery/fade.h"
 #include "luaX.h"
+#include "watch.h"
+#include "bake.h"
+#include "triple_buffer.h"
+#include "jobs.h"
+#include "cellfile.h"
+#include "arena.h"
 
 static const bool CHECK_UPDATES = false;
+// Number of players handled by a single task in step_players.
+static const unsigned int PLAYER_GRAIN = 16;
 
 struct grid;
 struct blocks;
 struct gems;
 struct fade;
+struct cells;
+struct triggers;
+
+struct scene_state {
+    lua_State * lua;
+    int tick_function;
+    PHYSFS_sint64 map_script_moddate;
+    char script_file[256];
+    glm::dvec3 start;
+    int globals_snapshot;
+    // Memory of the scenery, which is freed at once when the map is unloaded.
+    arena memory;
+};
+
+static scene_state buffers[2];
+static scene_state * active = &buffers[0];
+static scene_state * staged = &buffers[1];
+
+static scene_state & current() {
+    return use_staged_scenery ? *staged : *active;
+}
+
+arena & map_arena() {
+    return current().memory;
+}
 
 static char next_map[64];
 static bool load_next_map = false;
-static int lua_tick_function = LUA_REFNIL;
-static PHYSFS_sint64 map_script_moddate;
-static char script_file[256];
+static std::thread prefetcher;
+
+thread_local bool replaying_baked_map = false;
+thread_local bool use_staged_scenery = false;
+
+static bool load_current(const char * filename);
+static void unload_current();
+
+// Loads the next map into the staged scene, such that it can be swapped in after the fade out.
+static void prefetch(const char * filename) {
+    use_staged_scenery = true;
+    unload_current();
+    if (!load_current(filename)) {
+        fprintf(stderr, "Failed to load map '%s'\n", filename);
+    }
+}
+
+static void start_prefetch() {
+    if (prefetcher.joinable()) prefetcher.join();
+    static char filename[80];
+    snprintf(filename, 80, "maps/%s", next_map);
+    prefetcher = std::thread(prefetch, filename);
+}
 
 static void do_load_map(lua_State * ) {
     load_next_map = true;
@@ -45,11 +102,13 @@ static void do_load_map(lua_State * ) {
 
 // load_map(filename)
 static int load_map(lua_State * L) {
+    luaL_argcheck(L, !use_staged_scenery, 1, "cannot load a map while loading a map");
     size_t length;
     const char * map = luaL_checklstring(L, -1, &length);
     luaL_argcheck(L, length<64, 1, "map path too long (max. 63 characters)");
     memcpy(next_map, map, length+1);
     lua_pop(L, 1);
+    start_prefetch();
     fade_state = FADE_STATES::FADE_OUT;
     fade_action = do_load_map;
     return 0;
@@ -69,7 +128,7 @@ static int quit_game(lua_State * ) {
 // set_start(position)
 static int set_start(lua_State * L) {
     luaL_argcheck(L, lua_gettop(L)==1, 1, "Expected only 1 position argument");
-    position = luaX_get_vector(L) + glm::dvec3(0,PLAYER_SIZE,0);
+    current().start = luaX_get_vector(L) + glm::dvec3(0,PLAYER_SIZE,0);
     return 0;
 }
 
@@ -77,93 +136,319 @@ static int fake_set_start(lua_State *) {
     return 0;
 }
 
-static lua_State * scene_lua;
-
-static void obtain_lua_tick_function(lua_State * L) {
-    lua_tick_function = LUA_REFNIL;
+static void obtain_lua_tick_function(scene_state & s) {
+    lua_State * L = s.lua;
+    s.tick_function = LUA_REFNIL;
     lua_getglobal(L, "tick");
     if (lua_isnil(L, -1)) {
         lua_pop(L,1);
     } else if (lua_isfunction(L, -1)) {
-        lua_tick_function = luaL_ref(L, LUA_REGISTRYINDEX);
+        s.tick_function = luaL_ref(L, LUA_REGISTRYINDEX);
     } else {
         fprintf(stderr, "'tick' is not a valid function");
         lua_pop(L,1);
     }
 }
 
+// Starts the scene once it is active.
+static void activate() {
+    reset(active->start, active->script_file);
+    scenery<fade>::init(active->lua);
+    if (CHECK_UPDATES) watch::start(active->script_file);
+}
+
+static void open_scene(const char* filename, bool do_reset) {
+    scene_state & s = current();
+    s.map_script_moddate = PHYSFS_getLastModTime(filename);
+    if (s.script_file != filename) strncpy(s.script_file, filename, 255);
+    if (do_reset) s.start = glm::dvec3(0, PLAYER_SIZE, 0);
+    s.tick_function = LUA_REFNIL;
+    assert(s.lua == NULL);
+    lua_State * L = s.lua = luaL_newstate();
+    luaL_requiref(L, "math", luaopen_math, true);
+    lua_pop(L,1);
+    luaX_open_math_ext(L);
+    scenery<grid>::init(L);
+    scenery<blocks>::init(L);
+    scenery<gems>::init(L);
+    scenery<triggers>::init(L);
+    scenery<cells>::init(L);
+    lua_register(L, "set_start", do_reset?set_start:fake_set_start);
+    lua_register(L, "load_map", load_map);
+    lua_register(L, "quit",     quit_game);
+}
+
 static bool do_load(const char* filename, bool do_reset) {
-    map_script_moddate = PHYSFS_getLastModTime(filename);
-    strncpy(script_file, filename, 255);
-    assert(scene_lua == NULL);
-    scene_lua = luaL_newstate();
-    luaL_requiref(scene_lua, "math", luaopen_math, true);
-    lua_pop(scene_lua,1);
-    luaX_open_math_ext(scene_lua);
-    scenery<grid>::init(scene_lua);
-    scenery<blocks>::init(scene_lua);
-    scenery<gems>::init(scene_lua);
-    scenery<fade>::init(scene_lua);
-    lua_register(scene_lua, "set_start", do_reset?set_start:fake_set_start);
-    lua_register(scene_lua, "load_map", load_map);
-    lua_register(scene_lua, "quit",     quit_game);
-    if (do_reset) reset(glm::dvec3(0, PLAYER_SIZE, 0));
-    if (!luaX_execute_script(scene_lua, filename)) {
+    scene_state & s = current();
+    open_scene(filename, do_reset);
+    if (!luaX_execute_script(s.lua, filename)) {
         return false;
     }
-    obtain_lua_tick_function(scene_lua);
+    obtain_lua_tick_function(s);
+    return true;
+}
+
+// Loads the baked version of the map, if it exists and is up to date.
+static bool do_load_baked(const char* filename) {
+    char baked[256];
+    bake::baked_name(baked, filename, sizeof(baked));
+    if (!PHYSFS_exists(baked) || PHYSFS_getLastModTime(baked) < PHYSFS_getLastModTime(filename)) {
+        return false;
+    }
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", PHYSFS_getRealDir(baked), baked);
+    bake::reader r(path);
+    if (!r.ok()) {
+        return false;
+    }
+    
+    scene_state & s = current();
+    open_scene(filename, false);
+    s.start = glm::dvec3(r.head->start[0], r.head->start[1], r.head->start[2]);
+    if (!scenery<blocks>::unbake(r) || !scenery<gems>::unbake(r)) {
+        unload_current();
+        return false;
+    }
+    
+    // The script is only needed for the tick function and gem actions.
+    if (r.head->flags & bake::SCRIPTED) {
+        replaying_baked_map = true;
+        bool ok = luaX_execute_script(s.lua, filename);
+        replaying_baked_map = false;
+        if (!ok) {
+            unload_current();
+            return false;
+        }
+        obtain_lua_tick_function(s);
+    }
+    return true;
+}
+
+// Stores the state after loading, such that restarting does not require executing the script again.
+static void take_snapshot() {
+    scene_state & s = current();
+    s.globals_snapshot = luaX_snapshot_globals(s.lua);
+    scenery<grid>::snapshot();
+    scenery<blocks>::snapshot();
+    scenery<gems>::snapshot();
+    scenery<triggers>::snapshot();
+    scenery<cells>::snapshot();
+    scenery<fade>::snapshot();
+}
+
+static void restore_snapshot() {
+    luaX_restore_globals(active->lua, active->globals_snapshot);
+    scenery<grid>::restore();
+    scenery<blocks>::restore();
+    scenery<gems>::restore();
+    scenery<triggers>::restore();
+    scenery<cells>::restore();
+    scenery<fade>::restore();
+    reset(active->start, active->script_file);
+}
+
+static bool load_current(const char* filename) {
+    bool ok = do_load_baked(filename) || do_load(filename, true);
+    take_snapshot();
+    return ok;
+}
+
+bool scene::mount_map_file(const char * argv0, const char * filename, char * script, size_t size) {
+    char path[PATH_MAX];
+    if (!realpath(filename, path)) {
+        perror("Could not open map");
+        return false;
+    }
+    char * name = strrchr(path,'/');
+    *name++ = 0;
+    snprintf(script, size, "maps/%s", name);
+    PHYSFS_init(argv0);
+    PHYSFS_mount(path[0]?path:"/", "/maps/", 1);
     return true;
 }
 
 bool scene::load(const char* filename) {
-    return do_load(filename, true);
+    bool ok = load_current(filename);
+    activate();
+    return ok;
 }
 
-void scene::unload() {
+bool scene::bake(const char* filename, const char* target) {
+    bool ok = do_load(filename, true);
+    if (ok) {
+        bake::writer w(target);
+        ok = w.ok();
+        w.head.start[0] = active->start.x;
+        w.head.start[1] = active->start.y;
+        w.head.start[2] = active->start.z;
+        if (active->tick_function != LUA_REFNIL) w.head.flags |= bake::SCRIPTED;
+        scenery<blocks>::bake(w);
+        scenery<gems>::bake(w);
+        scenery<triggers>::bake(w);
+    }
+    scene::unload();
+    return ok;
+}
+
+bool scene::bake_cells(const char* filename, const char* target, float cell_size) {
+    bool ok = do_load(filename, true);
+    if (ok) {
+        std::vector<cellfile::block> static_blocks;
+        scenery<blocks>::export_cells(static_blocks);
+        ok = cellfile::write(target, static_blocks, cell_size);
+        if (ok) printf("Wrote %u static blocks to '%s'\n", (uint)static_blocks.size(), target);
+    }
+    scene::unload();
+    return ok;
+}
+
+// Closes the lua state, but keeps the scenery that can be reused by the reloaded script.
+static void unload_for_reload() {
+    scenery<grid>::retain();
+    scenery<blocks>::retain();
+    scenery<gems>::retain();
+    scenery<triggers>::retain();
+    scenery<cells>::retain();
+    scenery<fade>::retain();
+    lua_close(active->lua);
+    active->lua = NULL;
+}
+
+// Unloads the scene that is loaded by this thread.
+static void unload_current() {
+    scene_state & s = current();
     scenery<grid>::clear();
     scenery<blocks>::clear();
     scenery<gems>::clear();
+    scenery<triggers>::clear();
+    scenery<cells>::clear();
     scenery<fade>::clear();
-    lua_close(scene_lua);
-    scene_lua = NULL;
+    if (s.lua) lua_close(s.lua);
+    s.lua = NULL;
+    s.tick_function = LUA_REFNIL;
+    s.memory.reset();
+}
+
+void scene::unload() {
+    if (prefetcher.joinable()) prefetcher.join();
+    watch::stop();
+    unload_current();
+    use_staged_scenery = true;
+    unload_current();
+    use_staged_scenery = false;
+}
+
+size_t scene::memory() {
+    return scenery<blocks>::memory() + scenery<gems>::memory() + scenery<triggers>::memory() + scenery<cells>::memory();
+}
+
+// Frames handed from the simulation to the render thread.
+static triple_buffer frames;
+static camera_state frame_camera[3];
+static double frame_time[3];
+
+void scene::publish(double time) {
+    uint f = frames.write_index();
+    frame_camera[f] = get_camera();
+    frame_time[f] = time;
+    scenery<grid>::publish(f);
+    scenery<blocks>::publish(f);
+    scenery<cells>::publish(f);
+    scenery<gems>::publish(f);
+    scenery<fade>::publish(f);
+    frames.publish();
+}
+
+void scene::prepare_frame(double time) {
+    frames.acquire();
+    uint f = frames.read_index();
+    double alpha = (time - frame_time[f]) / MILLISECONDS_PER_STEP;
+    interpolate(frame_camera[f], std::min(std::max(alpha, 0.0), 1.0));
 }
 
 void scene::draw() {
-    scenery<grid>::draw();
-    scenery<blocks>::draw();
-    scenery<gems>::draw();
-    scenery<fade>::draw();
+    uint f = frames.read_index();
+    scenery<grid>::draw(f);
+    scenery<blocks>::draw(f);
+    scenery<cells>::draw(f);
+    scenery<gems>::draw(f);
+    scenery<fade>::draw(f);
 }
 
 void scene::interact() {
     if (load_next_map) {
-        scene::unload();
+        // The map has been loaded during the fade out.
         printf("Loading map %s\n", next_map);
-        char next[80];
-        snprintf(next, 80, "maps/%s", next_map);
-        scene::load(next);
+        prefetcher.join();
+        std::swap(active, staged);
+        scenery<grid>::swap();
+        scenery<blocks>::swap();
+        scenery<gems>::swap();
+        scenery<triggers>::swap();
+        scenery<cells>::swap();
+        scenery<fade>::swap();
+        activate();
         load_next_map = false;
     }
-    if (reload || CHECK_UPDATES) {
-        if (map_script_moddate != PHYSFS_getLastModTime(script_file)) {
-            scene::unload();
-            printf("Reloading %s\n", script_file);
-            do_load(script_file, false);
-        } 
-        reload = false;
-    }
-    if (lua_tick_function != LUA_REFNIL) {
-        lua_rawgeti(scene_lua, LUA_REGISTRYINDEX, lua_tick_function);
-        lua_pushinteger(scene_lua, move_counter);
-        if (lua_pcall(scene_lua, 1, 0, 0) != 0) {
-            fprintf(stderr, "error running tick function: %s\n", lua_tostring(scene_lua, -1));
-            lua_pop(scene_lua, 1);
+    if ((reload.exchange(false) && active->map_script_moddate != PHYSFS_getLastModTime(active->script_file)) || (CHECK_UPDATES && watch::changed())) {
+        unload_for_reload();
+        printf("Reloading %s\n", active->script_file);
+        do_load(active->script_file, false);
+        take_snapshot();
+        scenery<fade>::init(active->lua);
+    }
+    if (restart.exchange(false) && fade_state != FADE_STATES::FADE_OUT && fade_state != FADE_STATES::BLACK) {
+        restore_snapshot();
+    }
+    lua_State * L = active->lua;
+    // Blocks restored from the history must not be moved again by the tick function.
+    bool rewound = scenery<blocks>::rewind(player.move_counter);
+    if (!rewound && active->tick_function != LUA_REFNIL) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, active->tick_function);
+        lua_pushinteger(L, player.move_counter);
+        if (lua_pcall(L, 1, 0, 0) != 0) {
+            fprintf(stderr, "error running tick function: %s\n", lua_tostring(L, -1));
+            lua_pop(L, 1);
         }
     }
     
-    airborne = true;
-    scenery<blocks>::interact(scene_lua);
-    scenery<grid>::interact(scene_lua);
-    scenery<gems>::interact(scene_lua);
-    scenery<fade>::interact(scene_lua);
+    player.airborne = true;
+    scenery<blocks>::interact(L, player);
+    scenery<cells>::interact(L, player);
+    scenery<grid>::interact(L, player);
+    // Events of triggers are dispatched at once, after all collisions.
+    scenery<triggers>::interact(L, player);
+    scenery<gems>::interact(L, player);
+    scenery<fade>::interact(L, player);
+}
+
+bool scene::call(const char * function, int argument) {
+    lua_State * L = active->lua;
+    if (!L) return false;
+    lua_getglobal(L, function);
+    if (!lua_isfunction(L, -1)) {
+        fprintf(stderr, "'%s' is not a function\n", function);
+        lua_pop(L, 1);
+        return false;
+    }
+    lua_pushinteger(L, argument);
+    if (lua_pcall(L, 1, 0, 0) != 0) {
+        fprintf(stderr, "error running %s: %s\n", function, lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return false;
+    }
+    return true;
+}
+
+void scene::step_players(std::vector<player_state> & players, const std::vector<player_input> & inputs) {
+    jobs::parallel_for(players.size(), PLAYER_GRAIN, [&](uint begin, uint end) {
+        for (uint i=begin; i<end; i++) {
+            player_state & p = players[i];
+            p.airborne = true;
+            scenery<blocks>::collide(p);
+            scenery<cells>::collide(p);
+            scenery<grid>::collide(p);
+            step_player(p, inputs[i]);
+        }
+    });
 }
@@ -18,12 +18,38 @@
 
 #ifndef SCENE_H
 #define SCENE_H
+#include <vector>
+
+struct player_state;
+struct player_input;
 
 namespace scene {
+    /** 
+     * Initializes PhysFS with the directory of a map file mounted as maps/, for the tools that take a map file as argument.
+     * Stores the name of the map script within PhysFS in script. Returns false if the file does not exist.
+     */
+    bool mount_map_file(const char * argv0, const char * filename, char * script, size_t size);
     bool load(const char * filename);
+    /** Executes the map script and writes the resulting scenery to target. */
+    bool bake(const char * filename, const char * target);
+    /** Executes the map script and writes its static blocks to a cell file, such that they can be streamed. */
+    bool bake_cells(const char * filename, const char * target, float cell_size);
     void unload();
+    /** Returns the number of bytes allocated for the scenery of the loaded map. */
+    size_t memory();
+    /** Hands the state after a simulation step, which ends at the given time in milliseconds, to the render thread. */
+    void publish(double time);
+    /** Selects the most recently published frame and interpolates the camera for drawing at the given time. */
+    void prepare_frame(double time);
     void draw();
     void interact();
+    /** Calls a global function of the active map script with an integer argument. Returns false if this fails. */
+    bool call(const char * function, int argument);
+    /** 
+     * Steps many independent players through the active scene in parallel, for example to verify runs or for agents.
+     * This only handles collision and movement, the scene itself is not changed.
+     */
+    void step_players(std::vector<player_state> & players, const std::vector<player_input> & inputs);
 };
 
 #endif
@@ -1,4 +1,9 @@
 #include <vector>
+#include <cstring>
+#include <climits>
+#include <cmath>
+#include <unordered_map>
+#include <algorithm>
 #include <GL/gl.h>
 #include <lua.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -6,7 +11,16 @@
 #include "../point_types.h"
 #include "../events.h"
 #include "../luaX.h"
+#include "../bake.h"
+#include "../jobs.h"
+#include "../spectate.h"
+#include "../cellfile.h"
+#include "../arena.h"
+#include "../art.h"
+#include "../occlusion.h"
+#include <glm/gtc/quaternion.hpp>
 #include "scenery.h"
+#include "cube.h"
 
 struct blocks;
 
@@ -16,35 +30,92 @@ struct block_info {
     glm::dvec3 size;
     glm::dmat3 rotation;
     glm::dmat3 rotational_velocity;
-    glm::dvec3 lb;
-    glm::dvec3 ub;
     int color;
+    /** Compares the fields that are set by the map script. */
+    bool same_as(const block_info &b) const {
+        return position == b.position && velocity == b.velocity && size == b.size && 
+            rotation == b.rotation && rotational_velocity == b.rotational_velocity && color == b.color;
+    }
 };
 
-static glm::dvec3 cube_coords[] = {
-    glm::dvec3(-1,-1,-1),
-    glm::dvec3(-1,-1, 1),
-    glm::dvec3(-1, 1,-1),
-    glm::dvec3(-1, 1, 1),
-    glm::dvec3( 1,-1,-1),
-    glm::dvec3( 1,-1, 1),
-    glm::dvec3( 1, 1,-1),
-    glm::dvec3( 1, 1, 1),
+// Number of blocks handled by a single task of a parallel loop.
+static const unsigned int BLOCK_GRAIN = 256;
+// Maps with fewer blocks are drawn without occlusion culling, as it would not pay off.
+static const unsigned int OCCLUSION_MIN_BLOCKS = 1024;
+
+/**
+ * Single precision copy of the fields that are scanned for every block in each step.
+ * This is a fifth of the size of block_info, such that scanning all blocks touches far less memory.
+ * The results are only used to skip blocks, hence collision is still computed exactly from block_info.
+ * Fields that the scans do not need, such as the color, are left out.
+ */
+struct block_hot {
+    float position[3];
+    float radius; // Distance from the center to the corners, including the collision epsilon.
+    float rotation[4]; // quaternion (w,x,y,z)
+    float size[3];
 };
+static_assert(sizeof(block_hot) == 44, "block_hot should contain only the scanned fields");
+
+// Bound on the rounding error of distances computed from a hot record.
+static float hot_margin(const block_hot & h, const glm::dvec3 & p) {
+    float magnitude = std::abs(h.position[0]) + std::abs(h.position[1]) + std::abs(h.position[2]) + h.radius;
+    magnitude += std::abs(p.x) + std::abs(p.y) + std::abs(p.z);
+    return 1e-4f + magnitude * 1e-5f;
+}
+
+// Memory needed for the given number of blocks in the arrays of block_container that are allocated from the map arena.
+static size_t block_bytes(size_t blocks) {
+    return blocks * (sizeof(block_info) + 8*sizeof(point3fc) + 48*sizeof(unsigned int) + sizeof(point3f) + sizeof(block_hot));
+}
 
 struct block_container {
-    std::vector<block_info> info;
-    std::vector<point3fc> coordinates;
-    std::vector<unsigned short> face_indices;
-    std::vector<unsigned short> wire_indices;
-    std::vector<point3f> collision_nodes;
+    arena_vector<block_info> info;
+    arena_vector<point3fc> coordinates;
+    arena_vector<unsigned int> face_indices;
+    arena_vector<unsigned int> wire_indices;
+    arena_vector<point3f> collision_nodes;
+    arena_vector<block_hot> hot;
     unsigned int blocks;
-    void recompute(unsigned int i) {
+    // Whether each block was placed as static.
+    std::vector<bool> fixed;
+    
+    // Blocks that are changed since the last call to publish_moved(), and their vertices before the change.
+    std::vector<unsigned int> moving;
+    std::vector<point3fc> moving_from;
+    std::vector<unsigned int> moving_serial;
+    unsigned int serial;
+    // Blocks that changed during the last simulation step, which are interpolated when drawn.
+    std::vector<unsigned int> moved;
+    std::vector<point3fc> moved_from;
+    
+    // Distance from the player to each block at the start of collision handling.
+    std::vector<double> distance;
+    // Incremented when the blocks are replaced as a whole, such that the spatial index is rebuilt.
+    unsigned int changes;
+    // Blocks changed since the spatial index was last updated, which it moves to their new cells.
+    std::vector<unsigned int> unindexed;
+    std::vector<bool> is_unindexed;
+    
+    // Stores the vertices of a block that is about to change, for interpolation.
+    void track(unsigned int i) {
+        assert(i<blocks);
+        if (is_unindexed.size() < blocks) is_unindexed.resize(blocks, false);
+        if (!is_unindexed[i]) {
+            is_unindexed[i] = true;
+            unindexed.push_back(i);
+        }
+        if (moving_serial.size() < blocks) moving_serial.resize(blocks, serial - 1);
+        if (moving_serial[i] != serial) {
+            moving_serial[i] = serial;
+            moving.push_back(i);
+            moving_from.insert(moving_from.end(), coordinates.begin() + i*8, coordinates.begin() + i*8 + 8);
+        }
+    }
+    // Updates the vertices of a block. Can be called in parallel for different blocks.
+    void compute(unsigned int i) {
         assert(i<blocks);
-        block_info &b = info[i];
-        glm::dvec3 r_pos = glm::transpose(b.rotation)*b.position;
-        b.lb = r_pos-b.size-COLLISION_EPSILON;
-        b.ub = r_pos+b.size+COLLISION_EPSILON;
+        const block_info &b = info[i];
         for (uint j=0; j<8; j++) {
             glm::dvec3 coord = b.rotation*(cube_coords[j]*b.size) + b.position;
             coordinates[i*8+j].x = coord.x;
@@ -52,17 +123,65 @@ struct block_container {
             coordinates[i*8+j].z = coord.z;
             coordinates[i*8+j].color = b.color;
         }
+        compute_hot(i);
+    }
+    void compute_hot(unsigned int i) {
+        const block_info &b = info[i];
+        block_hot &h = hot[i];
+        glm::quat q = glm::quat_cast(glm::mat3(b.rotation));
+        h.rotation[0] = q.w;
+        h.rotation[1] = q.x;
+        h.rotation[2] = q.y;
+        h.rotation[3] = q.z;
+        for (int k=0; k<3; k++) {
+            h.position[k] = b.position[k];
+            h.size[k] = b.size[k];
+        }
+        h.radius = (glm::length(b.size) + 2*COLLISION_EPSILON) * 1.0001;
+    }
+    void recompute(unsigned int i) {
+        track(i);
+        compute(i);
+    }
+    void publish_moved() {
+        moved.swap(moving);
+        moved_from.swap(moving_from);
+        forget_moved();
+    }
+    void forget_moved() {
+        moving.clear();
+        moving_from.clear();
+        serial++;
     }
     void clear() {
-        info.clear();
-        coordinates.clear();
-        face_indices.clear();
-        wire_indices.clear();
-        collision_nodes.clear();
+        release(info);
+        release(coordinates);
+        release(face_indices);
+        release(wire_indices);
+        release(collision_nodes);
+        release(hot);
+        fixed.clear();
         blocks = 0;
+        moving_serial.clear();
+        moved.clear();
+        moved_from.clear();
+        forget_moved();
+        unindexed.clear();
+        is_unindexed.clear();
+        changes++;
     }
 };
 
+// Transform of an object in world coordinates, which is composed of the transforms of the object and its ancestors.
+struct object_world {
+    glm::dvec3 offset;
+    glm::dvec3 velocity;
+    glm::dmat3 rotation;
+    glm::dmat3 rotational_velocity;
+};
+
+// The transform of an object is relative to its parent, if it has one.
+// Objects are created again on every reload, hence they do not use the map arena, which is only freed on unload.
 struct object {
     glm::dvec3 offset;
     glm::dvec3 velocity;
@@ -73,31 +192,209 @@ struct object {
     glm::dvec3 base_offset;
     std::vector<glm::dvec3> base_position;
     std::vector<glm::dmat3> base_rotation;
+    
+    int parent;
+    std::vector<unsigned int> children;
+    object_world world;
+    // Set when the object changed since its last update, or when a descendant did.
+    bool dirty;
+    bool dirty_descendants;
+};
+
+// The parts of an object that can change after loading.
+struct object_transform {
+    glm::dvec3 offset;
+    glm::dvec3 velocity;
+    glm::dmat3 rotation;
+    glm::dmat3 rotational_velocity;
+    object_world world;
+    bool dirty;
+};
+
+static object_transform get_transform(const object & obj) {
+    object_transform t = {obj.offset, obj.velocity, obj.rotation, obj.rotational_velocity, obj.world, obj.dirty};
+    return t;
+}
+
+static void set_transform(object & obj, const object_transform & t) {
+    obj.offset = t.offset;
+    obj.velocity = t.velocity;
+    obj.rotation = t.rotation;
+    obj.rotational_velocity = t.rotational_velocity;
+    obj.world = t.world;
+    obj.dirty = t.dirty;
+}
+
+// Computes the world transform of an object from the world transform of its parent.
+static object_world compose(const object_world & parent, const object & obj) {
+    object_world w;
+    glm::dvec3 rel = parent.rotation * obj.offset;
+    w.offset = parent.offset + rel;
+    w.rotation = parent.rotation * obj.rotation;
+    // The parent carries the origin of the object along, while the object moves relative to the rotating parent.
+    w.velocity = parent.velocity + parent.rotational_velocity*rel - rel + parent.rotational_velocity*(parent.rotation*obj.velocity);
+    w.rotational_velocity = parent.rotational_velocity * parent.rotation * obj.rotational_velocity * glm::transpose(parent.rotation);
+    return w;
+}
+
+static object_world world_transform(const std::vector<object> & objects, const object & obj) {
+    if (obj.parent < 0) {
+        object_world w = {obj.offset, obj.velocity, obj.rotation, obj.rotational_velocity};
+        return w;
+    }
+    return compose(objects[obj.parent].world, obj);
+}
+
+// Marks an object as changed, such that the next update of it or an ancestor recomputes its subtree.
+static void mark_dirty(std::vector<object> & objects, unsigned int i) {
+    objects[i].dirty = true;
+    for (int a = objects[i].parent; a >= 0 && !objects[a].dirty_descendants; a = objects[a].parent) {
+        objects[a].dirty_descendants = true;
+    }
+}
+
+// Number of moves for which the changes to blocks and objects are kept, such that they can be rewound.
+static const int WORLD_HISTORY = 1024;
+
+struct block_delta {
+    unsigned int block;
+    block_info before;
 };
 
-static block_container container;
-static std::vector<object> objects;
+struct object_delta {
+    unsigned int object;
+    object_transform before;
+};
 
-static short face_indices[] = {
-    1, 0, 2, 3,
-    4, 5, 7, 6,
-    0, 1, 5, 4, 
-    3, 2, 6, 7, 
-    2, 0, 4, 6,
-    1, 3, 7, 5,
+// The state of the blocks and objects that were changed during a single move.
+struct history_step {
+    unsigned int move;
+    std::vector<block_delta> blocks;
+    std::vector<object_delta> objects;
+};
+
+// Ring buffer of the most recent steps. Each block and object is saved when it is first changed in a step.
+struct world_history {
+    std::vector<history_step> steps;
+    unsigned int first, size;
+    bool recording;
+    // Per block and object, the serial of the step in which it was last saved.
+    unsigned int serial;
+    std::vector<unsigned int> saved_blocks;
+    std::vector<unsigned int> saved_objects;
+    history_step & top() {
+        return steps[(first + size - 1) % WORLD_HISTORY];
+    }
+    void clear() {
+        size = 0;
+        recording = false;
+    }
 };
-static short wire_indices[] = {
-    0,1,0,2,0,4,
-    1,3,1,5,
-    2,3,2,6,
-    3,7,
-    4,5,4,6,
-    5,7,
-    6,7,
+
+// Edge length of the cells of the spatial index.
+static const double INDEX_CELL_SIZE = 4;
+// Blocks that cover more cells than this are tested by every query instead.
+static const unsigned int INDEX_MAX_CELLS = 64;
+// Rays are cut off at this distance, such that their length is finite.
+static const double MAX_RAY_DISTANCE = 1e9;
+
+// Cell coordinates are limited to the range that cell_key can distinguish.
+static const int INDEX_CELL_LIMIT = (1 << 20) - 1;
+
+// Uniform grid over the bounding boxes of the blocks, for the spatial queries of map scripts.
+// The first query after blocks changed moves only those blocks to their new cells.
+// It is rebuilt when blocks are added or replaced as a whole.
+struct block_index {
+    unsigned int changes;
+    unsigned int blocks;
+    bool built;
+    std::unordered_map<uint64_t, std::vector<unsigned int>> cells;
+    std::vector<unsigned int> large;
+    std::vector<glm::vec3> lower;
+    std::vector<glm::vec3> upper;
+    // Range of cells that contain blocks, which bounds the walk of a ray. Empty if min > max.
+    // It only grows when blocks move, which keeps it conservative.
+    int cell_min[3];
+    int cell_max[3];
+    // Blocks that have been tested by the current query.
+    std::vector<unsigned int> visited;
+    unsigned int query;
+};
+
+struct block_scenery {
+    block_container container;
+    block_index index;
+    std::vector<object> objects;
+    // State after loading, used to restart the level.
+    std::vector<block_info> initial_info;
+    std::vector<point3fc> initial_coordinates;
+    std::vector<object_transform> initial_objects;
+    world_history history;
+    // Number of blocks and objects that the script of a baked map has placed so far.
+    unsigned int replayed_blocks;
+    unsigned int replayed_objects;
+    // Changed when blocks are replaced without tracking the changes, such that spectators need all blocks.
+    unsigned int generation;
+};
+
+static block_scenery buffers[2];
+static block_scenery * active = &buffers[0];
+static block_scenery * staged = &buffers[1];
+
+static block_scenery & current() {
+    return use_staged_scenery ? *staged : *active;
+}
+
+// Saves the block before it is changed for the first time in the current step.
+static void save_block(block_scenery & state, unsigned int i) {
+    world_history & h = state.history;
+    if (!h.recording) return;
+    if (h.saved_blocks.size() <= i) h.saved_blocks.resize(state.container.blocks, 0);
+    if (h.saved_blocks[i] == h.serial) return;
+    h.saved_blocks[i] = h.serial;
+    block_delta d = {i, state.container.info[i]};
+    h.top().blocks.push_back(d);
+}
+
+// Saves the object before it is changed for the first time in the current step.
+static void save_object(block_scenery & state, unsigned int i) {
+    world_history & h = state.history;
+    if (!h.recording) return;
+    if (h.saved_objects.size() <= i) h.saved_objects.resize(state.objects.size(), 0);
+    if (h.saved_objects[i] == h.serial) return;
+    h.saved_objects[i] = h.serial;
+    object_delta d = {i, get_transform(state.objects[i])};
+    h.top().objects.push_back(d);
+}
+
+// Layout of objects in baked maps, with the entries stored in a separate section.
+struct baked_object {
+    glm::dvec3 offset;
+    glm::dvec3 velocity;
+    glm::dmat3 rotation;
+    glm::dmat3 rotational_velocity;
+    glm::dvec3 base_offset;
+    uint32_t first_entry;
+    uint32_t entries;
+    int32_t parent;
+    uint32_t dirty;
+};
+
+struct baked_entry {
+    glm::dvec3 base_position;
+    glm::dmat3 base_rotation;
+    int32_t block;
 };
 
-// place_block(info{pos, vel, size, color}) : id;
+// place_block(info{pos, vel, size, color, static}) : id;
 static int place_block(lua_State * L) {
+    block_scenery & state = current();
+    block_container & container = state.container;
+    if (replaying_baked_map) {
+        luaL_argcheck(L, state.replayed_blocks<container.blocks, 1, "Script places more blocks than its baked map.");
+        lua_pushnumber(L, state.replayed_blocks++);
+        return 1;
+    }
     block_info info;
 
     if (luaX_check_field(L, 1, "pos")) {
@@ -119,29 +416,69 @@ static int place_block(lua_State * L) {
         info.color = 0xffffff;
     }
     
-    // Create entries.
-    int i = container.blocks;
-    for (uint j=0; j<24; j++) {
-        container.face_indices.push_back(face_indices[j] + i*8);
-        container.wire_indices.push_back(wire_indices[j] + i*8);
+    // Blocks that the script promises never to move, which are exported to cell files.
+    bool fixed = false;
+    if (luaX_check_field(L, 1, "static")) {
+        fixed = lua_toboolean(L, -1);
+        lua_pop(L, 1);
     }
-    container.info.push_back(info);
-    container.collision_nodes.push_back(point3f());
-    container.coordinates.resize(container.coordinates.size()+8);
+    
+    int i = container.blocks;
     container.blocks++;
+    if (container.fixed.size() <= (uint)i) container.fixed.resize(i+1);
+    container.fixed[i] = fixed;
+    if (i < (int)container.info.size()) {
+        // Reloading: the entries still exist and need updating only if the block has changed.
+        if (!container.info[i].same_as(info)) {
+            container.info[i] = info;
+            container.recompute(i);
+        }
+    } else {
+        // Create entries.
+        for (uint j=0; j<24; j++) {
+            container.face_indices.push_back(face_indices[j] + i*8);
+            container.wire_indices.push_back(wire_indices[j] + i*8);
+        }
+        container.info.push_back(info);
+        container.collision_nodes.push_back(point3f());
+        container.hot.push_back(block_hot());
+        container.coordinates.resize(container.coordinates.size()+8);
     
-    // Update computed values.
-    container.recompute(i);
+        // Update computed values.
+        container.recompute(i);
+    }
     
     // Return the block (as index)
     lua_pushnumber(L, i);
     return 1;
 }
 
+// reserve_blocks(count)
+// Allocates room for the given number of blocks, such that placing them does not need to grow any arrays.
+static int reserve_blocks(lua_State * L) {
+    block_container & container = current().container;
+    if (replaying_baked_map) return 0;
+    lua_Integer n = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, n >= 0, 1, "Block count must not be negative.");
+    if ((size_t)n <= container.info.capacity()) return 0;
+    map_arena().reserve(block_bytes(n) + 6*alignof(block_hot));
+    container.info.reserve(n);
+    container.coordinates.reserve(n*8);
+    container.face_indices.reserve(n*24);
+    container.wire_indices.reserve(n*24);
+    container.collision_nodes.reserve(n);
+    container.hot.reserve(n);
+    return 0;
+}
+
 // move_block(id, info{pos, vel, size, color});
 static int move_block(lua_State * L) {
+    block_scenery & state = current();
+    block_container & container = state.container;
+    if (replaying_baked_map) return 0;
     unsigned int i = lua_tointeger(L, 1);
     luaL_argcheck(L, i<container.blocks, 1, "Block id out of range.");
+    save_block(state, i);
     block_info &info = container.info[i];
 
     if (luaX_check_field(L, 2, "pos")) {
@@ -169,8 +506,12 @@ static int move_block(lua_State * L) {
 
 // rotate_block(id, {axis, angle(deg), angle_vel(deg), reset})
 static int rotate_block(lua_State * L) {
+    block_scenery & state = current();
+    block_container & container = state.container;
+    if (replaying_baked_map) return 0;
     unsigned int i = lua_tointeger(L, 1);
     luaL_argcheck(L, i<container.blocks, 1, "Block id out of range.");
+    save_block(state, i);
     block_info &info = container.info[i];
 
     bool ok = false;
@@ -212,6 +553,15 @@ static int rotate_block(lua_State * L) {
 
 // create_object(blocks(list), origin)
 int create_object(lua_State* L) {
+    block_scenery & state = current();
+    block_container & container = state.container;
+    std::vector<object> & objects = state.objects;
+    if (replaying_baked_map) {
+        luaL_argcheck(L, state.replayed_objects<objects.size(), 1, "Script creates more objects than its baked map.");
+        lua_settop(L, 0);
+        lua_pushnumber(L, state.replayed_objects++);
+        return 1;
+    }
     int r = objects.size();
     objects.resize(objects.size()+1);
     object & obj = objects.back();
@@ -233,6 +583,11 @@ int create_object(lua_State* L) {
         obj.base_rotation.push_back(container.info[id].rotation);
     }
     
+    obj.parent = -1;
+    obj.world = world_transform(objects, obj);
+    obj.dirty = true;
+    obj.dirty_descendants = false;
+    
     lua_pop(L,1);
     lua_pushnumber(L, r);
     return 1;
@@ -240,8 +595,13 @@ int create_object(lua_State* L) {
 
 // move_object(id, {offset, acceleration, reset})
 int move_object(lua_State* L) {
+    block_scenery & state = current();
+    std::vector<object> & objects = state.objects;
+    if (replaying_baked_map) return 0;
     unsigned int obj_id = lua_tointeger(L, 1);
     luaL_argcheck(L, obj_id<objects.size(), 1, "Object id out of range.");
+    save_object(state, obj_id);
+    mark_dirty(objects, obj_id);
     object & obj = objects[obj_id];
 
     bool ok = false;
@@ -272,8 +632,13 @@ int move_object(lua_State* L) {
 
 // rotate_object(id, {axis, angle(deg), angle_vel(deg), reset})
 static int rotate_object(lua_State * L) {
+    block_scenery & state = current();
+    std::vector<object> & objects = state.objects;
+    if (replaying_baked_map) return 0;
     unsigned int obj_id = lua_tointeger(L, 1);
     luaL_argcheck(L, obj_id<objects.size(), 1, "Object id out of range.");
+    save_object(state, obj_id);
+    mark_dirty(objects, obj_id);
     object & obj = objects[obj_id];
 
     bool ok = false;
@@ -310,58 +675,953 @@ static int rotate_object(lua_State * L) {
     return 0;
 }
 
+// Recomputes the world transform of the changed objects in the subtree of the given object, top-down.
+// Subtrees without changes are skipped. The changed objects are appended to the list.
+static void update_tree(block_scenery & state, unsigned int i, bool parent_changed, std::vector<unsigned int> & changed) {
+    std::vector<object> & objects = state.objects;
+    object & obj = objects[i];
+    if (!parent_changed && !obj.dirty && !obj.dirty_descendants) return;
+    bool update = parent_changed || obj.dirty;
+    if (update) {
+        save_object(state, i);
+        obj.world = world_transform(objects, obj);
+        obj.dirty = false;
+        changed.push_back(i);
+    }
+    obj.dirty_descendants = false;
+    for (unsigned int c : obj.children) {
+        update_tree(state, c, update, changed);
+    }
+}
+
+// Updates the blocks of the changed objects in the subtree of the given object.
+static void update_blocks(block_scenery & state, unsigned int obj_id) {
+    block_container & container = state.container;
+    std::vector<object> & objects = state.objects;
+    std::vector<unsigned int> changed;
+    update_tree(state, obj_id, false, changed);
+    for (unsigned int o : changed) {
+        const object & obj = objects[o];
+        int n = obj.entries.size();
+        for (int i=0; i<n; i++) {
+            save_block(state, obj.entries[i]);
+            container.track(obj.entries[i]);
+        }
+        const object_world & w = obj.world;
+        jobs::parallel_for(n, BLOCK_GRAIN, [&](uint begin, uint end) {
+            for (uint i=begin; i<end; i++) {
+                block_info &block = container.info[obj.entries[i]];
+                glm::dvec3 rel_pos = w.rotation * obj.base_position[i];
+                block.position = rel_pos + w.offset;
+                block.rotation = w.rotation * obj.base_rotation[i];
+                block.velocity = w.velocity + w.rotational_velocity*rel_pos - rel_pos;
+                block.rotational_velocity = w.rotational_velocity;
+                container.compute(obj.entries[i]);
+            }
+        });
+    }
+}
+
 // update_object(id)
 int update_object(lua_State* L) {
+    block_scenery & state = current();
+    if (replaying_baked_map) return 0;
     unsigned int obj_id = lua_tointeger(L, 1);
-    luaL_argcheck(L, obj_id<objects.size(), 1, "Object id out of range.");
-    object & obj = objects[obj_id];
-    
-    int n = obj.entries.size();
-    for (int i=0; i<n; i++) {
-        block_info &block = container.info[obj.entries[i]];
-        glm::dvec3 rel_pos = obj.rotation * obj.base_position[i];
-        block.position = rel_pos + obj.offset;
-        block.rotation = obj.rotation * obj.base_rotation[i];
-        block.velocity = obj.velocity + obj.rotational_velocity*rel_pos - rel_pos;
-        block.rotational_velocity = obj.rotational_velocity;
-        container.recompute(obj.entries[i]);
+    luaL_argcheck(L, obj_id<state.objects.size(), 1, "Object id out of range.");
+    update_blocks(state, obj_id);
+    return 0;
+}
+
+// attach_object(child, parent)
+static int attach_object(lua_State* L) {
+    block_scenery & state = current();
+    std::vector<object> & objects = state.objects;
+    if (replaying_baked_map) return 0;
+    unsigned int child = lua_tointeger(L, 1);
+    unsigned int parent = lua_tointeger(L, 2);
+    luaL_argcheck(L, child<objects.size(), 1, "Object id out of range.");
+    luaL_argcheck(L, parent<objects.size(), 2, "Object id out of range.");
+    luaL_argcheck(L, objects[child].parent < 0, 1, "Object already has a parent.");
+    luaL_argcheck(L, !state.history.recording, 1, "Objects can only be attached while loading the map.");
+    for (int a = parent; a >= 0; a = objects[a].parent) {
+        luaL_argcheck(L, (unsigned int)a != child, 2, "Object cannot be attached to its own descendant.");
     }
     
+    // Express the current transform of the child relative to the parent, such that attaching does not move it.
+    object & obj = objects[child];
+    const object_world & p = objects[parent].world;
+    glm::dmat3 inverse = glm::transpose(p.rotation);
+    glm::dmat3 inverse_velocity = glm::transpose(p.rotational_velocity);
+    glm::dvec3 rel = obj.offset - p.offset;
+    obj.velocity = inverse * (inverse_velocity * (obj.velocity - p.velocity - p.rotational_velocity*rel + rel));
+    obj.rotational_velocity = inverse * inverse_velocity * obj.rotational_velocity * p.rotation;
+    obj.offset = inverse * rel;
+    obj.base_offset = inverse * (obj.base_offset - p.offset);
+    obj.rotation = inverse * obj.rotation;
+    obj.parent = parent;
+    objects[parent].children.push_back(child);
+    mark_dirty(objects, child);
     return 0;
 }
 
+static bool finite(const glm::dvec3 & v) {
+    return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z);
+}
+
+static uint64_t cell_key(int x, int y, int z) {
+    const uint64_t mask = (1 << 21) - 1;
+    return ((uint64_t)(x & mask) << 42) | ((uint64_t)(y & mask) << 21) | (uint64_t)(z & mask);
+}
+
+static int cell_of(double coordinate) {
+    double c = std::floor(coordinate / INDEX_CELL_SIZE);
+    // Also maps NaN to a valid cell.
+    if (!(c > -INDEX_CELL_LIMIT)) return -INDEX_CELL_LIMIT;
+    if (c > INDEX_CELL_LIMIT) return INDEX_CELL_LIMIT;
+    return (int)c;
+}
+
+// Obtains the cells covered by the bounding box of a block. Returns false if it covers too many cells to be binned.
+static bool cell_range(const block_index & index, unsigned int i, int lo[3], int hi[3]) {
+    for (int k=0; k<3; k++) {
+        lo[k] = cell_of(index.lower[i][k]);
+        hi[k] = cell_of(index.upper[i][k]);
+    }
+    return (uint64_t)(hi[0]-lo[0]+1)*(hi[1]-lo[1]+1)*(hi[2]-lo[2]+1) <= INDEX_MAX_CELLS;
+}
+
+static void insert_block(const block_container & container, block_index & index, unsigned int i) {
+    glm::vec3 lo(INFINITY), hi(-INFINITY);
+    for (uint j=0; j<8; j++) {
+        const point3fc & c = container.coordinates[i*8+j];
+        glm::vec3 v(c.x, c.y, c.z);
+        lo = glm::min(lo, v);
+        hi = glm::max(hi, v);
+    }
+    index.lower[i] = lo;
+    index.upper[i] = hi;
+    int c0[3], c1[3];
+    if (!cell_range(index, i, c0, c1)) {
+        index.large.push_back(i);
+        return;
+    }
+    for (int k=0; k<3; k++) {
+        index.cell_min[k] = std::min(index.cell_min[k], c0[k]);
+        index.cell_max[k] = std::max(index.cell_max[k], c1[k]);
+    }
+    for (int x=c0[0]; x<=c1[0]; x++) for (int y=c0[1]; y<=c1[1]; y++) for (int z=c0[2]; z<=c1[2]; z++) {
+        index.cells[cell_key(x,y,z)].push_back(i);
+    }
+}
+
+// Removes a block from the cells of the bounding box it had when it was inserted.
+static void remove_block(block_index & index, unsigned int i) {
+    int c0[3], c1[3];
+    if (!cell_range(index, i, c0, c1)) {
+        index.large.erase(std::find(index.large.begin(), index.large.end(), i));
+        return;
+    }
+    for (int x=c0[0]; x<=c1[0]; x++) for (int y=c0[1]; y<=c1[1]; y++) for (int z=c0[2]; z<=c1[2]; z++) {
+        auto cell = index.cells.find(cell_key(x,y,z));
+        std::vector<unsigned int> & ids = cell->second;
+        *std::find(ids.begin(), ids.end(), i) = ids.back();
+        ids.pop_back();
+        if (ids.empty()) index.cells.erase(cell);
+    }
+}
+
+static void build_index(const block_container & container, block_index & index) {
+    uint n = container.blocks;
+    index.lower.resize(n);
+    index.upper.resize(n);
+    index.visited.assign(n, 0);
+    index.query = 0;
+    index.large.clear();
+    index.cells.clear();
+    for (int k=0; k<3; k++) {
+        index.cell_min[k] = INT_MAX;
+        index.cell_max[k] = INT_MIN;
+    }
+    for (uint i=0; i<n; i++) {
+        insert_block(container, index, i);
+    }
+    index.changes = container.changes;
+    index.blocks = n;
+    index.built = true;
+}
+
+static block_index & get_index(block_scenery & state) {
+    block_index & index = state.index;
+    block_container & container = state.container;
+    if (!index.built || index.changes != container.changes || index.blocks != container.blocks) {
+        build_index(container, index);
+    } else {
+        for (unsigned int i : container.unindexed) {
+            remove_block(index, i);
+            insert_block(container, index, i);
+        }
+    }
+    for (unsigned int i : container.unindexed) container.is_unindexed[i] = false;
+    container.unindexed.clear();
+    index.query++;
+    return index;
+}
+
+// Calls f for every block in the cell that was not yet visited by the current query.
+template<class F>
+static void visit_cell(block_index & index, int x, int y, int z, F f) {
+    auto it = index.cells.find(cell_key(x,y,z));
+    if (it == index.cells.end()) return;
+    for (unsigned int i : it->second) {
+        if (index.visited[i] == index.query) continue;
+        index.visited[i] = index.query;
+        f(i);
+    }
+}
+
+// Intersects a ray with a block. Returns the distance along the ray to the first hit, or INFINITY.
+static double ray_block(const block_info & b, const glm::dvec3 & origin, const glm::dvec3 & dir, glm::dvec3 & normal) {
+    glm::dvec3 o = (origin - b.position) * b.rotation;
+    glm::dvec3 d = dir * b.rotation;
+    double near = -INFINITY, far = INFINITY;
+    int axis = 0;
+    double sign = 1;
+    for (int k=0; k<3; k++) {
+        if (d[k] == 0) {
+            if (std::abs(o[k]) > b.size[k]) return INFINITY;
+            continue;
+        }
+        double t0 = (-b.size[k] - o[k]) / d[k];
+        double t1 = ( b.size[k] - o[k]) / d[k];
+        double s = -1;
+        if (t0 > t1) {
+            std::swap(t0, t1);
+            s = 1;
+        }
+        if (t0 > near) {
+            near = t0;
+            axis = k;
+            sign = s;
+        }
+        far = std::min(far, t1);
+    }
+    if (near > far || far < 0) return INFINITY;
+    if (near < 0) {
+        // The origin is inside the block.
+        normal = -dir;
+        return 0;
+    }
+    glm::dvec3 n;
+    n[axis] = sign;
+    normal = b.rotation * n;
+    return near;
+}
+
+// Tests whether a block overlaps an axis aligned box, by trying to find a separating axis.
+static bool box_block(const block_info & b, const glm::dvec3 & center, const glm::dvec3 & half) {
+    glm::dvec3 t = b.position - center;
+    const glm::dmat3 & r = b.rotation;
+    glm::dmat3 a;
+    for (int i=0; i<3; i++) for (int j=0; j<3; j++) a[j][i] = std::abs(r[j][i]) + 1e-9;
+    // Axes of the box.
+    for (int i=0; i<3; i++) {
+        double rb = b.size[0]*a[0][i] + b.size[1]*a[1][i] + b.size[2]*a[2][i];
+        if (std::abs(t[i]) > half[i] + rb) return false;
+    }
+    // Axes of the block.
+    for (int j=0; j<3; j++) {
+        double ra = half[0]*a[j][0] + half[1]*a[j][1] + half[2]*a[j][2];
+        if (std::abs(glm::dot(t, r[j])) > ra + b.size[j]) return false;
+    }
+    // Cross products of the axes.
+    for (int i=0; i<3; i++) {
+        int i1 = (i+1)%3, i2 = (i+2)%3;
+        for (int j=0; j<3; j++) {
+            int j1 = (j+1)%3, j2 = (j+2)%3;
+            double ra = half[i1]*a[j][i2] + half[i2]*a[j][i1];
+            double rb = b.size[j1]*a[j2][i] + b.size[j2]*a[j1][i];
+            double d = std::abs(t[i2]*r[j][i1] - t[i1]*r[j][i2]);
+            if (d > ra + rb) return false;
+        }
+    }
+    return true;
+}
+
+// raycast(origin, direction, max_distance) : {id, distance, point, normal} or nil
+static int raycast(lua_State * L) {
+    block_scenery & state = current();
+    lua_settop(L, 3);
+    double max_distance = luaL_checknumber(L, 3);
+    luaL_argcheck(L, max_distance >= 0, 3, "Distance must not be negative.");
+    lua_pop(L, 1);
+    glm::dvec3 dir = luaX_get_vector(L);
+    glm::dvec3 origin = luaX_get_vector(L);
+    luaL_argcheck(L, finite(origin), 1, "Origin must be finite.");
+    luaL_argcheck(L, finite(dir) && glm::length(dir) > 0, 2, "Direction must be finite and not zero.");
+    dir = glm::normalize(dir);
+    
+    block_index & index = get_index(state);
+    const block_container & container = state.container;
+    double best = std::min(max_distance, MAX_RAY_DISTANCE);
+    int hit = -1;
+    glm::dvec3 hit_normal;
+    auto test = [&](unsigned int i) {
+        glm::dvec3 normal;
+        double t = ray_block(container.info[i], origin, dir, normal);
+        // Ties go to the lowest id, such that the result does not depend on the order within the cells.
+        if (t < INFINITY && (t < best || (t == best && (hit < 0 || (int)i < hit)))) {
+            best = t;
+            hit = i;
+            hit_normal = normal;
+        }
+    };
+    for (unsigned int i : index.large) {
+        index.visited[i] = index.query;
+        test(i);
+    }
+    
+    // The part of the ray within the cells that contain blocks.
+    double enter = 0, leave = best;
+    if (index.cell_min[0] > index.cell_max[0]) leave = -1;
+    for (int k=0; k<3; k++) {
+        double lo = index.cell_min[k] * INDEX_CELL_SIZE;
+        double hi = (index.cell_max[k] + 1.0) * INDEX_CELL_SIZE;
+        if (dir[k] == 0) {
+            if (origin[k] < lo || origin[k] >= hi) leave = -1;
+            continue;
+        }
+        double t0 = (lo - origin[k]) / dir[k];
+        double t1 = (hi - origin[k]) / dir[k];
+        enter = std::max(enter, std::min(t0, t1));
+        leave = std::min(leave, std::max(t0, t1));
+    }
+    
+    // Walk through the cells along the ray, until the nearest hit lies before the next cell or the ray leaves the cells.
+    if (enter <= leave) {
+        int cell[3], step[3];
+        double next[3], delta[3];
+        glm::dvec3 start = origin + dir * enter;
+        for (int k=0; k<3; k++) {
+            cell[k] = std::min(std::max(cell_of(start[k]), index.cell_min[k]), index.cell_max[k]);
+            step[k] = dir[k] < 0 ? -1 : 1;
+            double boundary = (cell[k] + (dir[k] < 0 ? 0 : 1)) * INDEX_CELL_SIZE;
+            next[k] = dir[k] != 0 ? (boundary - origin[k]) / dir[k] : INFINITY;
+            delta[k] = dir[k] != 0 ? INDEX_CELL_SIZE / std::abs(dir[k]) : INFINITY;
+        }
+        double t = enter;
+        while (t <= best && t <= leave) {
+            visit_cell(index, cell[0], cell[1], cell[2], test);
+            int k = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+            t = next[k];
+            next[k] += delta[k];
+            cell[k] += step[k];
+            if (cell[k] < index.cell_min[k] || cell[k] > index.cell_max[k]) break;
+        }
+    }
+    
+    if (hit < 0) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, hit);
+    lua_setfield(L, -2, "id");
+    lua_pushnumber(L, best);
+    lua_setfield(L, -2, "distance");
+    luaX_push_vector(L, origin + dir * best);
+    lua_setfield(L, -2, "point");
+    luaX_push_vector(L, hit_normal);
+    lua_setfield(L, -2, "normal");
+    return 1;
+}
+
+// overlap_box(center, half_size) : list of ids
+static int overlap_box(lua_State * L) {
+    block_scenery & state = current();
+    lua_settop(L, 2);
+    glm::dvec3 half = luaX_get_vector(L);
+    glm::dvec3 center = luaX_get_vector(L);
+    luaL_argcheck(L, finite(center), 1, "Center must be finite.");
+    luaL_argcheck(L, finite(half), 2, "Size must be finite.");
+    half = glm::abs(half);
+    
+    block_index & index = get_index(state);
+    const block_container & container = state.container;
+    glm::dvec3 lo = center - half, hi = center + half;
+    std::vector<unsigned int> found;
+    auto test = [&](unsigned int i) {
+        const glm::vec3 & l = index.lower[i];
+        const glm::vec3 & u = index.upper[i];
+        if (u.x < lo.x || u.y < lo.y || u.z < lo.z || l.x > hi.x || l.y > hi.y || l.z > hi.z) return;
+        if (!box_block(container.info[i], center, half)) return;
+        found.push_back(i);
+    };
+    for (unsigned int i : index.large) {
+        index.visited[i] = index.query;
+        test(i);
+    }
+    
+    // Only the cells that contain blocks are visited. If these are more than the blocks, all blocks are tested instead.
+    int c0[3], c1[3];
+    uint64_t cells = 1;
+    for (int k=0; k<3; k++) {
+        c0[k] = std::max(cell_of(lo[k]), index.cell_min[k]);
+        c1[k] = std::min(cell_of(hi[k]), index.cell_max[k]);
+        cells *= c0[k] <= c1[k] ? c1[k] - c0[k] + 1 : 0;
+    }
+    if (cells > container.blocks) {
+        for (uint i=0; i<container.blocks; i++) {
+            if (index.visited[i] != index.query) test(i);
+        }
+    } else if (cells > 0) {
+        for (int x=c0[0]; x<=c1[0]; x++) {
+            for (int y=c0[1]; y<=c1[1]; y++) {
+                for (int z=c0[2]; z<=c1[2]; z++) {
+                    visit_cell(index, x, y, z, test);
+                }
+            }
+        }
+    }
+    
+    std::sort(found.begin(), found.end());
+    lua_createtable(L, found.size(), 0);
+    for (uint k=0; k<found.size(); k++) {
+        lua_pushinteger(L, found[k]);
+        lua_rawseti(L, -2, k+1);
+    }
+    return 1;
+}
+
+#ifdef USE_LUAJIT
+/*
+ * Typed access to the blocks and objects for the FFI of LuaJIT. Calls through the FFI are compiled 
+ * by the JIT, while calls to the functions above need to marshal their arguments through tables.
+ * The object functions do the same as the Lua functions with reset=1.
+ */
+extern "C" {
+    static unsigned int ffi_block_count() {
+        return current().container.blocks;
+    }
+    // The array is valid until the next block is placed.
+    static const block_hot * ffi_blocks() {
+        return current().container.hot.data();
+    }
+    static unsigned int ffi_object_count() {
+        return current().objects.size();
+    }
+    // World transform of the object at its last update.
+    static const object_world * ffi_object(unsigned int id) {
+        std::vector<object> & objects = current().objects;
+        return id < objects.size() ? &objects[id].world : NULL;
+    }
+    static void ffi_move_object(unsigned int id, double x, double y, double z, double vx, double vy, double vz) {
+        block_scenery & state = current();
+        if (replaying_baked_map || id >= state.objects.size()) return;
+        save_object(state, id);
+        mark_dirty(state.objects, id);
+        object & obj = state.objects[id];
+        obj.offset = obj.base_offset + glm::dvec3(x, y, z);
+        obj.velocity = glm::dvec3(vx, vy, vz);
+    }
+    static void ffi_rotate_object(unsigned int id, double ax, double ay, double az, double angle, double angle_vel) {
+        block_scenery & state = current();
+        if (replaying_baked_map || id >= state.objects.size()) return;
+        save_object(state, id);
+        mark_dirty(state.objects, id);
+        object & obj = state.objects[id];
+        glm::dvec3 axis(ax, ay, az);
+        obj.rotation = glm::dmat3(glm::rotate(glm::dmat4(), angle, axis));
+        obj.rotational_velocity = glm::dmat3(glm::rotate(glm::dmat4(), angle_vel, axis));
+    }
+    static void ffi_update_object(unsigned int id) {
+        block_scenery & state = current();
+        if (replaying_baked_map || id >= state.objects.size()) return;
+        update_blocks(state, id);
+    }
+}
+
+// Defines the global blocks_ffi, with the functions above cast to their FFI types.
+static const char * FFI_BINDING = 
+    "local ffi, f = ...\n"
+    "ffi.cdef[[\n"
+    "  typedef struct { float position[3]; float radius; float rotation[4]; float size[3]; } blockgame_block;\n"
+    "  typedef struct { double offset[3]; double velocity[3]; double rotation[9]; double rotational_velocity[9]; } blockgame_transform;\n"
+    "]]\n"
+    "blocks_ffi = {\n"
+    "  block_count   = ffi.cast('unsigned int (*)()', f.block_count),\n"
+    "  blocks        = ffi.cast('const blockgame_block * (*)()', f.blocks),\n"
+    "  object_count  = ffi.cast('unsigned int (*)()', f.object_count),\n"
+    "  object        = ffi.cast('const blockgame_transform * (*)(unsigned int)', f.object),\n"
+    "  move_object   = ffi.cast('void (*)(unsigned int, double, double, double, double, double, double)', f.move_object),\n"
+    "  rotate_object = ffi.cast('void (*)(unsigned int, double, double, double, double, double)', f.rotate_object),\n"
+    "  update_object = ffi.cast('void (*)(unsigned int)', f.update_object),\n"
+    "}\n";
+
+static void set_pointer(lua_State * L, const char * name, void * pointer) {
+    lua_pushlightuserdata(L, pointer);
+    lua_setfield(L, -2, name);
+}
+
+static void open_ffi_binding(lua_State * L) {
+    if (luaL_loadstring(L, FFI_BINDING) != 0) {
+        fprintf(stderr, "Failed to load FFI binding: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return;
+    }
+    // Only the binding gets the ffi module, as it gives access to all memory.
+    luaL_requiref(L, LUA_FFILIBNAME, luaopen_ffi, false);
+    lua_newtable(L);
+    set_pointer(L, "block_count",   (void*)ffi_block_count);
+    set_pointer(L, "blocks",        (void*)ffi_blocks);
+    set_pointer(L, "object_count",  (void*)ffi_object_count);
+    set_pointer(L, "object",        (void*)ffi_object);
+    set_pointer(L, "move_object",   (void*)ffi_move_object);
+    set_pointer(L, "rotate_object", (void*)ffi_rotate_object);
+    set_pointer(L, "update_object", (void*)ffi_update_object);
+    if (lua_pcall(L, 2, 0, 0) != 0) {
+        fprintf(stderr, "Failed to open FFI binding: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+    }
+}
+#endif
+
 template<>
 void scenery<blocks>::init(lua_State* L) {
     lua_register(L, "place_block",   place_block);
+    lua_register(L, "reserve_blocks", reserve_blocks);
     lua_register(L, "move_block",    move_block);
     lua_register(L, "rotate_block",  rotate_block);
     lua_register(L, "create_object", create_object);
     lua_register(L, "update_object", update_object);
     lua_register(L, "move_object",   move_object);
     lua_register(L, "rotate_object", rotate_object);
+    lua_register(L, "attach_object", attach_object);
+    lua_register(L, "raycast",       raycast);
+    lua_register(L, "overlap_box",   overlap_box);
+#ifdef USE_LUAJIT
+    open_ffi_binding(L);
+#endif
 }
 
 template<>
 void scenery<blocks>::clear() {
-    container.clear();
-    objects.clear();
+    block_scenery & state = current();
+    state.container.clear();
+    state.objects.clear();
+    state.initial_info.clear();
+    state.initial_coordinates.clear();
+    state.initial_objects.clear();
+    state.history.clear();
+    state.generation++;
+}
+
+template<>
+void scenery<blocks>::retain() {
+    block_scenery & state = current();
+    // Keep the block entries, such that place_block only recomputes blocks that changed.
+    state.container.blocks = 0;
+    state.objects.clear();
+    state.history.clear();
+}
+
+template<>
+void scenery<blocks>::bake(bake::writer & w) {
+    block_container & container = current().container;
+    std::vector<object> & objects = current().objects;
+    w.write(bake::BLOCKS, container.info.data(), container.blocks);
+    w.write(bake::COORDINATES, container.coordinates.data(), container.blocks*8);
+    
+    std::vector<baked_object> baked_objects;
+    std::vector<baked_entry> baked_entries;
+    for (const object & obj : objects) {
+        baked_object b = {
+            obj.offset, obj.velocity, obj.rotation, obj.rotational_velocity, obj.base_offset, 
+            (uint32_t)baked_entries.size(), (uint32_t)obj.entries.size(), obj.parent, obj.dirty
+        };
+        baked_objects.push_back(b);
+        for (uint i=0; i<obj.entries.size(); i++) {
+            baked_entry e = {obj.base_position[i], obj.base_rotation[i], obj.entries[i]};
+            baked_entries.push_back(e);
+        }
+    }
+    w.write(bake::OBJECTS, baked_objects.data(), baked_objects.size());
+    w.write(bake::OBJECT_ENTRIES, baked_entries.data(), baked_entries.size());
+}
+
+// Recomputes the world transforms of an object and its descendants, without changing their blocks.
+static void compose_tree(std::vector<object> & objects, unsigned int i) {
+    objects[i].world = world_transform(objects, objects[i]);
+    for (unsigned int c : objects[i].children) {
+        compose_tree(objects, c);
+    }
+}
+
+template<>
+bool scenery<blocks>::unbake(const bake::reader & r) {
+    block_scenery & state = current();
+    block_container & container = state.container;
+    std::vector<object> & objects = state.objects;
+    uint32_t n, coordinates, object_count, entry_count;
+    const block_info * info = r.get<block_info>(bake::BLOCKS, n);
+    const point3fc * coords = r.get<point3fc>(bake::COORDINATES, coordinates);
+    const baked_object * baked_objects = r.get<baked_object>(bake::OBJECTS, object_count);
+    const baked_entry * baked_entries = r.get<baked_entry>(bake::OBJECT_ENTRIES, entry_count);
+    if (!info || !coords || !baked_objects || !baked_entries || coordinates != n*8) {
+        fprintf(stderr, "Baked blocks have an incompatible layout\n");
+        return false;
+    }
+    
+    // The vertices are stored as well, such that no block needs to be recomputed.
+    map_arena().reserve(block_bytes(n) + 6*alignof(block_hot));
+    container.info.assign(info, info+n);
+    container.coordinates.assign(coords, coords+n*8);
+    container.collision_nodes.resize(n);
+    container.hot.resize(n);
+    container.face_indices.resize(n*24);
+    container.wire_indices.resize(n*24);
+    for (uint i=0; i<n; i++) {
+        for (uint j=0; j<24; j++) {
+            container.face_indices[i*24+j] = face_indices[j] + i*8;
+            container.wire_indices[i*24+j] = wire_indices[j] + i*8;
+        }
+    }
+    container.blocks = n;
+    container.changes++;
+    jobs::parallel_for(n, BLOCK_GRAIN, [&](uint begin, uint end) {
+        for (uint i=begin; i<end; i++) container.compute_hot(i);
+    });
+    
+    objects.resize(object_count);
+    for (uint i=0; i<object_count; i++) {
+        const baked_object & b = baked_objects[i];
+        object & obj = objects[i];
+        obj.offset = b.offset;
+        obj.velocity = b.velocity;
+        obj.rotation = b.rotation;
+        obj.rotational_velocity = b.rotational_velocity;
+        obj.base_offset = b.base_offset;
+        obj.parent = b.parent >= 0 && (uint32_t)b.parent < object_count ? b.parent : -1;
+        obj.dirty = b.dirty != 0;
+        obj.dirty_descendants = false;
+        for (uint j=b.first_entry; j<b.first_entry+b.entries && j<entry_count; j++) {
+            obj.entries.push_back(baked_entries[j].block);
+            obj.base_position.push_back(baked_entries[j].base_position);
+            obj.base_rotation.push_back(baked_entries[j].base_rotation);
+        }
+    }
+    for (uint i=0; i<object_count; i++) {
+        if (objects[i].parent >= 0) objects[objects[i].parent].children.push_back(i);
+    }
+    // The blocks are baked as they are, hence only the world transforms must be recomputed.
+    for (uint i=0; i<object_count; i++) {
+        if (objects[i].parent < 0) compose_tree(objects, i);
+        if (objects[i].dirty) mark_dirty(objects, i);
+    }
+    state.replayed_blocks = 0;
+    state.replayed_objects = 0;
+    return true;
+}
+
+template<>
+void scenery<blocks>::swap() {
+    std::swap(active, staged);
+}
+
+template<>
+void scenery<blocks>::snapshot() {
+    block_scenery & state = current();
+    const block_container & container = state.container;
+    state.initial_info.assign(container.info.begin(), container.info.begin() + container.blocks);
+    state.initial_coordinates.assign(container.coordinates.begin(), container.coordinates.begin() + container.blocks*8);
+    state.initial_objects.clear();
+    for (const object & obj : state.objects) {
+        state.initial_objects.push_back(get_transform(obj));
+    }
+    // Changes made while loading should not be interpolated.
+    state.container.forget_moved();
+    state.container.moved.clear();
+    state.generation++;
 }
 
 template<>
-void scenery<blocks>::draw() {
+void scenery<blocks>::restore() {
+    block_container & container = active->container;
+    std::copy(active->initial_info.begin(), active->initial_info.end(), container.info.begin());
+    std::copy(active->initial_coordinates.begin(), active->initial_coordinates.end(), container.coordinates.begin());
+    container.blocks = active->initial_info.size();
+    container.changes++;
+    jobs::parallel_for(container.blocks, BLOCK_GRAIN, [&](uint begin, uint end) {
+        for (uint i=begin; i<end; i++) container.compute_hot(i);
+    });
+    for (uint i=0; i<active->initial_objects.size(); i++) {
+        set_transform(active->objects[i], active->initial_objects[i]);
+        active->objects[i].dirty_descendants = false;
+    }
+    for (uint i=0; i<active->initial_objects.size(); i++) {
+        if (active->objects[i].dirty) mark_dirty(active->objects, i);
+    }
+    active->history.clear();
+    container.forget_moved();
+    container.moved.clear();
+    active->generation++;
+}
+
+static spectate::block_update spectator_update(const block_container & container, uint i) {
+    const block_hot & h = container.hot[i];
+    spectate::block_update u;
+    u.index = i;
+    u.color = container.info[i].color;
+    memcpy(u.position, h.position, sizeof(u.position));
+    memcpy(u.rotation, h.rotation, sizeof(u.rotation));
+    memcpy(u.size, h.size, sizeof(u.size));
+    return u;
+}
+
+template<>
+void scenery<blocks>::spectate(spectate::writer & w) {
+    static const block_scenery * last_scene = NULL;
+    static unsigned int last_generation = 0;
+    const block_container & container = active->container;
+    if (active != last_scene || active->generation != last_generation) {
+        last_scene = active;
+        last_generation = active->generation;
+        w.full = true;
+    }
+    w.blocks = container.blocks;
+    if (w.full) {
+        for (uint i=0; i<container.blocks; i++) {
+            w.updates.push_back(spectator_update(container, i));
+        }
+    } else {
+        for (uint i : container.moved) {
+            if (i < container.blocks) w.updates.push_back(spectator_update(container, i));
+        }
+    }
+}
+
+template<>
+void scenery<blocks>::export_cells(std::vector<cellfile::block> & out) {
+    const block_container & container = active->container;
+    // Only blocks placed as static are exported, as the tick function could move any other block.
+    // Static blocks that are part of an object or have a velocity are skipped, as they move regardless.
+    std::vector<bool> moving(container.blocks, false);
+    for (const object & obj : active->objects) {
+        for (int i : obj.entries) moving[i] = true;
+    }
+    unsigned int skipped = 0;
+    for (uint i=0; i<container.blocks; i++) {
+        const block_info & b = container.info[i];
+        if (i >= container.fixed.size() || !container.fixed[i]) continue;
+        if (moving[i] || b.velocity != glm::dvec3() || b.rotational_velocity != glm::dmat3()) {
+            skipped++;
+            continue;
+        }
+        spectate::block_update u = spectator_update(container, i);
+        cellfile::block c;
+        memcpy(c.position, u.position, sizeof(c.position));
+        memcpy(c.size, u.size, sizeof(c.size));
+        memcpy(c.rotation, u.rotation, sizeof(c.rotation));
+        c.color = u.color;
+        out.push_back(c);
+    }
+    if (skipped) fprintf(stderr, "Skipped %u static blocks that move\n", skipped);
+}
+
+template<>
+bool scenery<blocks>::block_motion(unsigned int id, glm::dvec3 & position, glm::dvec3 & velocity) {
+    const block_container & container = active->container;
+    if (id >= container.blocks) return false;
+    position = container.info[id].position;
+    velocity = container.info[id].velocity;
+    return true;
+}
+
+template<>
+size_t scenery<blocks>::memory() {
+    const block_scenery & state = current();
+    const block_container & c = state.container;
+    size_t bytes = vector_bytes(c.info) + vector_bytes(c.coordinates) + vector_bytes(c.face_indices) + vector_bytes(c.wire_indices);
+    bytes += vector_bytes(c.collision_nodes) + vector_bytes(c.hot) + vector_bytes(c.distance);
+    bytes += vector_bytes(c.moving) + vector_bytes(c.moving_from) + vector_bytes(c.moving_serial);
+    bytes += vector_bytes(c.moved) + vector_bytes(c.moved_from) + c.fixed.capacity() / 8;
+    bytes += vector_bytes(state.objects);
+    for (const object & obj : state.objects) {
+        bytes += vector_bytes(obj.entries) + vector_bytes(obj.base_position) + vector_bytes(obj.base_rotation) + vector_bytes(obj.children);
+    }
+    bytes += vector_bytes(state.initial_info) + vector_bytes(state.initial_coordinates) + vector_bytes(state.initial_objects);
+    for (const history_step & step : state.history.steps) {
+        bytes += sizeof(step) + vector_bytes(step.blocks) + vector_bytes(step.objects);
+    }
+    return bytes;
+}
+
+// Undoes the changes made in the most recent step.
+// This is done in reverse, as a continued step can save the same block twice.
+static void undo_step(block_scenery & state) {
+    history_step & step = state.history.top();
+    for (auto d = step.blocks.rbegin(); d != step.blocks.rend(); ++d) {
+        state.container.info[d->block] = d->before;
+        state.container.recompute(d->block);
+    }
+    for (auto d = step.objects.rbegin(); d != step.objects.rend(); ++d) {
+        set_transform(state.objects[d->object], d->before);
+        // Make sure the update of an ancestor reaches the object again.
+        if (d->before.dirty) mark_dirty(state.objects, d->object);
+    }
+    state.history.size--;
+}
+
+// Drops the saved state of blocks and objects that did not actually change, then starts a new step.
+static void begin_step(block_scenery & state, unsigned int move) {
+    world_history & h = state.history;
+    if (h.size > 0) {
+        history_step & step = h.top();
+        uint j = 0;
+        for (const block_delta & d : step.blocks) {
+            if (!state.container.info[d.block].same_as(d.before)) step.blocks[j++] = d;
+        }
+        step.blocks.resize(j);
+    }
+    if (h.steps.empty()) h.steps.resize(WORLD_HISTORY);
+    if (h.size == WORLD_HISTORY) {
+        h.first = (h.first + 1) % WORLD_HISTORY;
+        h.size--;
+    }
+    h.size++;
+    history_step & step = h.top();
+    step.move = move;
+    step.blocks.clear();
+    step.objects.clear();
+    h.serial++;
+}
+
+template<>
+bool scenery<blocks>::rewind(unsigned int move) {
+    world_history & h = active->history;
+    if (!h.recording) {
+        h.recording = true;
+        h.size = 0;
+        begin_step(*active, move);
+        return false;
+    }
+    if (h.top().move < move) {
+        begin_step(*active, move);
+        return false;
+    }
+    if (h.top().move == move) {
+        return false;
+    }
+    while (h.size > 0 && h.top().move > move) {
+        undo_step(*active);
+    }
+    // Blocks and objects may be saved again by the step that is continued now.
+    h.serial++;
+    if (h.size == 0) {
+        // The history does not go back far enough.
+        begin_step(*active, move);
+        return false;
+    }
+    return true;
+}
+
+// The state of the blocks that is handed to the render thread.
+struct block_frame {
+    std::vector<point3fc> coordinates;
+    std::vector<unsigned int> face_indices;
+    std::vector<unsigned int> wire_indices;
+    std::vector<point3f> collision_nodes;
+    unsigned int blocks;
+    std::vector<unsigned int> moved;
+    std::vector<point3fc> moved_from;
+    std::vector<point3fc> moved_to;
+    // Indices of the clusters that are not occluded, filled by the render thread.
+    std::vector<unsigned int> visible;
+    std::vector<unsigned int> visible_faces;
+    std::vector<unsigned int> visible_wires;
+};
+
+static block_frame frames[3];
+
+template<>
+void scenery<blocks>::publish(unsigned int f) {
+    const block_container & container = active->container;
+    block_frame & frame = frames[f];
+    uint n = container.blocks;
+    frame.blocks = n;
+    frame.coordinates.assign(container.coordinates.begin(), container.coordinates.begin() + n*8);
+    frame.collision_nodes.assign(container.collision_nodes.begin(), container.collision_nodes.begin() + n);
+    // The indices only depend on the number of blocks.
+    if (frame.face_indices.size() < n*24) {
+        frame.face_indices.assign(container.face_indices.begin(), container.face_indices.begin() + n*24);
+        frame.wire_indices.assign(container.wire_indices.begin(), container.wire_indices.begin() + n*24);
+    }
+    frame.moved = container.moved;
+    frame.moved_from = container.moved_from;
+}
+
+// Moves the vertices of the blocks that changed in the last simulation step to the given fraction between their previous and current position.
+// With alpha=1 the vertices are restored to their current position.
+static void interpolate_moved(block_frame & frame, double alpha) {
+    frame.moved_to.resize(frame.moved.size()*8);
+    jobs::parallel_for(frame.moved.size(), BLOCK_GRAIN, [&](uint begin, uint end) {
+        for (uint k=begin; k<end; k++) {
+            if (frame.moved[k] >= frame.blocks) continue;
+            for (uint j=0; j<8; j++) {
+                point3fc & p = frame.coordinates[frame.moved[k]*8+j];
+                point3fc & to = frame.moved_to[k*8+j];
+                const point3fc & from = frame.moved_from[k*8+j];
+                if (alpha < 1) {
+                    to = p;
+                    p.x = from.x + (to.x - from.x) * alpha;
+                    p.y = from.y + (to.y - from.y) * alpha;
+                    p.z = from.z + (to.z - from.z) * alpha;
+                } else {
+                    p = to;
+                }
+            }
+        }
+    });
+}
+
+template<>
+void scenery<blocks>::draw(unsigned int f) {
+    block_frame & container = frames[f];
+    bool interpolated = interpolation < 1 && !container.moved.empty();
+    if (interpolated) interpolate_moved(container, interpolation);
+    
+    // Only the clusters that are not hidden behind large blocks are drawn.
+    const unsigned int * faces = container.face_indices.data();
+    const unsigned int * wires = container.wire_indices.data();
+    uint indices = container.blocks*24;
+    if (occlusion::enabled && container.blocks >= OCCLUSION_MIN_BLOCKS) {
+        container.visible.clear();
+        container.visible_faces.clear();
+        container.visible_wires.clear();
+        occlusion::cull(container.coordinates.data(), container.blocks, glm::mat4(view_projection()), glm::vec3(camera_position), container.visible);
+        for (uint k : container.visible) {
+            uint begin = k*occlusion::CLUSTER_SIZE*24;
+            uint end = std::min(container.blocks, (k+1)*occlusion::CLUSTER_SIZE)*24;
+            container.visible_faces.insert(container.visible_faces.end(), faces + begin, faces + end);
+            container.visible_wires.insert(container.visible_wires.end(), wires + begin, wires + end);
+        }
+        faces = container.visible_faces.data();
+        wires = container.visible_wires.data();
+        indices = container.visible_faces.size();
+    }
+    
     // Cubes
     container.coordinates.data()->attach();
     glEnableClientState(GL_COLOR_ARRAY);
     glEnable(GL_POLYGON_OFFSET_FILL);
     glPolygonOffset(1,1);
-    glDrawElements(GL_QUADS, container.blocks*24, GL_UNSIGNED_SHORT, container.face_indices.data());
+    glDrawElements(GL_QUADS, indices, GL_UNSIGNED_INT, faces);
     glDisable(GL_POLYGON_OFFSET_FILL);
     glDisableClientState(GL_COLOR_ARRAY);
     
     // Cube outlines 
     glColor3f(0,0,0);
     glLineWidth(2);
-    glDrawElements(GL_LINES, container.blocks*24, GL_UNSIGNED_SHORT, container.wire_indices.data());
+    glDrawElements(GL_LINES, indices, GL_UNSIGNED_INT, wires);
 
     container.collision_nodes.data()->attach();
     glColor3f(0,0,0);
@@ -370,42 +1630,71 @@ void scenery<blocks>::draw() {
     glColor3f(1,1,1);
     glPointSize(2.0);
     glDrawArrays(GL_POINTS, 0, container.blocks);
+    
+    if (interpolated) interpolate_moved(container, 1);
+}
+
+// Pushes the player out of a block. Returns how far the player was moved.
+// If node is not NULL, it is set to the point of the block that is nearest to the player.
+// The bounding box in rotated coordinates is computed here rather than stored, which keeps block_info smaller.
+static double collide_block(const block_info & c, player_state & p, point3f * node) {
+    glm::dvec3 r_pos = glm::transpose(c.rotation)*c.position;
+    glm::dvec3 lb = r_pos-c.size-COLLISION_EPSILON;
+    glm::dvec3 ub = r_pos+c.size+COLLISION_EPSILON;
+    return collide_box(c.rotation, lb, ub, p, node, [&c](const glm::dvec3 & q) {
+        glm::dvec3 cn_rel_pos = q - c.position;
+        return c.velocity + c.rotational_velocity*cn_rel_pos - cn_rel_pos;
+    });
 }
 
 template<>
-void scenery<blocks>::interact(lua_State*) {
+void scenery<blocks>::interact(lua_State*, player_state & p) {
+    block_container & container = active->container;
+    // The blocks have been moved by the tick function at this point.
+    container.publish_moved();
+    
+    // Find the distance to all blocks in parallel. Pushing the player out of a block moves them
+    // at most as far as the push, which changes their distance to other blocks by no more than that.
+    // Hence only blocks within PLAYER_SIZE plus the total push so far need to be tested again,
+    // which is done in order, giving the same result as testing every block.
+    std::vector<double> & distance = container.distance;
+    distance.resize(container.blocks);
+    glm::dvec3 start = p.position;
+    jobs::parallel_for(container.blocks, BLOCK_GRAIN, [&](uint begin, uint end) {
+        for (uint i=begin; i<end; i++) {
+            // Uses the hot records, which underestimate the distance by at most the margin.
+            const block_hot &h = container.hot[i];
+            glm::quat q(h.rotation[0], h.rotation[1], h.rotation[2], h.rotation[3]);
+            glm::vec3 center(h.position[0], h.position[1], h.position[2]);
+            glm::vec3 extent = glm::vec3(h.size[0], h.size[1], h.size[2]) + (float)COLLISION_EPSILON;
+            glm::vec3 local = glm::conjugate(q) * (glm::vec3(start) - center);
+            glm::vec3 clamped = glm::min(extent, glm::max(-extent, local));
+            glm::vec3 projected = q * clamped + center;
+            point3f & n = container.collision_nodes[i];
+            n.x = projected.x;
+            n.y = projected.y;
+            n.z = projected.z;
+            distance[i] = std::max(glm::length(clamped - local) - hot_margin(h, start), 0.0f);
+        }
+    });
+    
     // Block collision.
+    double pushed = 0;
     for (uint i=0; i<container.blocks; i++) {
-        const block_info &c = container.info[i];
-        point3f & n = container.collision_nodes[i];
-        glm::dvec3 projected = c.rotation * glm::min(c.ub,glm::max(c.lb,position*c.rotation));
-        n.x = projected.x;
-        n.y = projected.y;
-        n.z = projected.z;
-        glm::dvec3 dist = projected - position;
-        double d = glm::dot(dist,dist);
-        if (1e-3 < d && d <= PLAYER_SIZE*PLAYER_SIZE) {
-            // Normalize dist
-            d = sqrt(d);
-            dist /= d;
-            
-            // Move out of cube
-            position -= dist*(PLAYER_SIZE-d-COLLISION_EPSILON);
-            
-            // Compute velocity of collision node
-            glm::dvec3 cn_rel_pos = projected - c.position;
-            glm::dvec3 cn_vel = c.velocity + c.rotational_velocity*cn_rel_pos - cn_rel_pos;
-                        
-            // Walking?
-            if (dist.y<-0.8) {
-                airborne = false;
-                velocity -= ground_vel;
-                ground_vel = cn_vel;
-                velocity += ground_vel;
-            }
+        if (distance[i] > PLAYER_SIZE + pushed + COLLISION_EPSILON) continue;
+        pushed += collide_block(container.info[i], p, &container.collision_nodes[i]);
+    }
+}
 
-            // Change velocity to not be moving into the cube.
-            velocity -= dist*std::max(glm::dot(dist, velocity-cn_vel), 0.0);
-        }
+template<>
+void scenery<blocks>::collide(player_state & p) {
+    const block_container & container = active->container;
+    for (uint i=0; i<container.blocks; i++) {
+        // Skip blocks of which the bounding sphere is out of reach.
+        const block_hot & h = container.hot[i];
+        glm::vec3 d = glm::vec3(p.position) - glm::vec3(h.position[0], h.position[1], h.position[2]);
+        float reach = PLAYER_SIZE + h.radius + hot_margin(h, p.position);
+        if (glm::dot(d, d) > reach * reach) continue;
+        collide_block(container.info[i], p, NULL);
     }
 }
@@ -0,0 +1,335 @@
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <GL/gl.h>
+#include <lua.hpp>
+#include <physfs.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "../point_types.h"
+#include "../events.h"
+#include "../filemap.h"
+#include "../cellfile.h"
+#include "scenery.h"
+#include "cube.h"
+
+struct cells;
+
+// Radius, in cells, around the player of the cells that are loaded in the background.
+static const int LOAD_RADIUS = 3;
+static const double DEFAULT_BUDGET_MIB = 64;
+
+// A block that never moves, with only what is needed for collision.
+struct static_block {
+    glm::dmat3 rotation;
+    glm::dvec3 lb;
+    glm::dvec3 ub;
+};
+
+// The blocks of a single cell. Cells are not changed after loading, such that the render thread can share them.
+struct cell {
+    std::vector<static_block> blocks;
+    std::vector<point3fc> coordinates;
+    std::vector<unsigned int> face_indices;
+    std::vector<unsigned int> wire_indices;
+    size_t bytes;
+};
+typedef std::shared_ptr<const cell> cell_ptr;
+
+struct cell_scenery {
+    filemap<char> file;
+    const cellfile::header * head;
+    const cellfile::cell_entry * index;
+    std::map<std::pair<int32_t,int32_t>, uint32_t> lookup;
+    size_t budget;
+    // Cells in memory, by their index entry.
+    std::map<uint32_t, cell_ptr> resident;
+    size_t resident_bytes;
+
+    // Background loader. Requests are sorted such that the nearest cell is at the back.
+    std::thread loader;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<uint32_t> requests;
+    std::vector<std::pair<uint32_t, cell_ptr>> loaded;
+    bool stopping;
+
+    // Number of cells loaded synchronously, because they were needed for collision before the loader got to them.
+    unsigned int stalls;
+};
+
+static cell_scenery buffers[2];
+static cell_scenery * active = &buffers[0];
+static cell_scenery * staged = &buffers[1];
+
+static cell_scenery & current() {
+    return use_staged_scenery ? *staged : *active;
+}
+
+// Estimate of the memory used by a cell with the given number of blocks.
+static size_t cell_bytes(uint32_t blocks) {
+    return sizeof(cell) + blocks * (sizeof(static_block) + 8*sizeof(point3fc) + 48*sizeof(unsigned int));
+}
+
+static cell_ptr load_cell(const cell_scenery & state, uint32_t entry) {
+    const cellfile::cell_entry & e = state.index[entry];
+    const cellfile::block * list = (const cellfile::block*)(state.file.list + e.offset);
+    std::shared_ptr<cell> c = std::make_shared<cell>();
+    c->blocks.resize(e.blocks);
+    c->coordinates.resize(e.blocks*8);
+    c->face_indices.resize(e.blocks*24);
+    c->wire_indices.resize(e.blocks*24);
+    for (uint i=0; i<e.blocks; i++) {
+        const cellfile::block & b = list[i];
+        glm::dvec3 position(b.position[0], b.position[1], b.position[2]);
+        glm::dvec3 size(b.size[0], b.size[1], b.size[2]);
+        static_block & s = c->blocks[i];
+        s.rotation = glm::mat3_cast(glm::dquat(b.rotation[0], b.rotation[1], b.rotation[2], b.rotation[3]));
+        glm::dvec3 r_pos = glm::transpose(s.rotation)*position;
+        s.lb = r_pos-size-COLLISION_EPSILON;
+        s.ub = r_pos+size+COLLISION_EPSILON;
+        for (uint j=0; j<8; j++) {
+            glm::dvec3 coord = s.rotation*(cube_coords[j]*size) + position;
+            point3fc & p = c->coordinates[i*8+j];
+            p.x = coord.x;
+            p.y = coord.y;
+            p.z = coord.z;
+            p.color = b.color;
+        }
+        for (uint j=0; j<24; j++) {
+            c->face_indices[i*24+j] = face_indices[j] + i*8;
+            c->wire_indices[i*24+j] = wire_indices[j] + i*8;
+        }
+    }
+    c->bytes = cell_bytes(e.blocks);
+    return c;
+}
+
+static void run_loader(cell_scenery * state) {
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (true) {
+        state->wake.wait(lock, [state]{return state->stopping || !state->requests.empty();});
+        if (state->stopping) return;
+        uint32_t entry = state->requests.back();
+        state->requests.pop_back();
+        lock.unlock();
+        cell_ptr c = load_cell(*state, entry);
+        lock.lock();
+        state->loaded.push_back(std::make_pair(entry, c));
+    }
+}
+
+static void stop_streaming(cell_scenery & state) {
+    if (state.loader.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.stopping = true;
+        }
+        state.wake.notify_one();
+        state.loader.join();
+        if (state.stalls) printf("Streaming had to wait for %u cells\n", state.stalls);
+    }
+    state.requests.clear();
+    state.loaded.clear();
+    state.resident.clear();
+    state.resident_bytes = 0;
+    state.lookup.clear();
+    state.head = NULL;
+    state.index = NULL;
+    state.file = filemap<char>();
+}
+
+// stream_cells(filename, budget_mib)
+static int stream_cells(lua_State * L) {
+    cell_scenery & state = current();
+    const char * filename = luaL_checklstring(L, 1, NULL);
+    double budget = luaL_optnumber(L, 2, DEFAULT_BUDGET_MIB);
+    luaL_argcheck(L, state.head == NULL, 1, "the map already streams a cell file");
+    luaL_argcheck(L, budget > 0, 2, "the memory budget must be positive");
+    const char * dir = PHYSFS_getRealDir(filename);
+    luaL_argcheck(L, dir != NULL, 1, "cell file not found");
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, filename);
+    state.file = filemap<char>(path);
+    state.head = cellfile::check(state.file.list, state.file.list == MAP_FAILED ? 0 : state.file.size, path);
+    if (!state.head) {
+        state.file = filemap<char>();
+        return luaL_error(L, "could not stream cell file '%s'", filename);
+    }
+    state.index = (const cellfile::cell_entry*)(state.head + 1);
+    for (uint32_t i=0; i<state.head->cells; i++) {
+        state.lookup[std::make_pair(state.index[i].x, state.index[i].z)] = i;
+    }
+    state.budget = budget * 1024 * 1024;
+    state.stopping = false;
+    state.stalls = 0;
+    state.loader = std::thread(run_loader, &state);
+    return 0;
+}
+
+template<>
+void scenery<cells>::init(lua_State* L) {
+    lua_register(L, "stream_cells", stream_cells);
+}
+
+template<>
+void scenery<cells>::clear() {
+    stop_streaming(current());
+}
+
+template<>
+void scenery<cells>::retain() {
+    // The script opens the cell file again when it is reloaded.
+    stop_streaming(current());
+}
+
+template<>
+void scenery<cells>::swap() {
+    std::swap(active, staged);
+}
+
+template<>
+void scenery<cells>::snapshot() {
+}
+
+template<>
+void scenery<cells>::restore() {
+}
+
+template<>
+size_t scenery<cells>::memory() {
+    return current().resident_bytes;
+}
+
+// Number of cells around the player that can contain blocks the player can touch.
+static int collision_radius(const cell_scenery & state) {
+    return std::ceil((PLAYER_SIZE + state.head->max_extent) / state.head->cell_size);
+}
+
+template<>
+void scenery<cells>::collide(player_state & p) {
+    const cell_scenery & state = *active;
+    if (!state.head) return;
+    float cell_size = state.head->cell_size;
+    int32_t px = cellfile::cell_of(p.position.x, cell_size);
+    int32_t pz = cellfile::cell_of(p.position.z, cell_size);
+    int near = collision_radius(state);
+    for (int dx=-near; dx<=near; dx++) {
+        for (int dz=-near; dz<=near; dz++) {
+            auto it = state.lookup.find(std::make_pair(px+dx, pz+dz));
+            if (it == state.lookup.end()) continue;
+            auto r = state.resident.find(it->second);
+            if (r == state.resident.end()) continue;
+            // The blocks do not move, hence neither do their points.
+            for (const static_block & b : r->second->blocks) {
+                collide_box(b.rotation, b.lb, b.ub, p, NULL, [](const glm::dvec3 &) { return glm::dvec3(); });
+            }
+        }
+    }
+}
+
+template<>
+void scenery<cells>::interact(lua_State*, player_state & p) {
+    cell_scenery & state = *active;
+    if (!state.head) return;
+    float cell_size = state.head->cell_size;
+    int32_t px = cellfile::cell_of(p.position.x, cell_size);
+    int32_t pz = cellfile::cell_of(p.position.z, cell_size);
+    int near = collision_radius(state);
+    int radius = std::max(near, LOAD_RADIUS);
+
+    std::unique_lock<std::mutex> lock(state.mutex);
+    for (auto & l : state.loaded) {
+        if (state.resident.emplace(l.first, l.second).second) {
+            state.resident_bytes += l.second->bytes;
+        }
+    }
+    state.loaded.clear();
+
+    // Cells within reach, nearest first.
+    std::vector<std::pair<int, uint32_t>> wanted;
+    for (int dx=-radius; dx<=radius; dx++) {
+        for (int dz=-radius; dz<=radius; dz++) {
+            auto it = state.lookup.find(std::make_pair(px+dx, pz+dz));
+            if (it != state.lookup.end()) wanted.push_back(std::make_pair(std::max(std::abs(dx), std::abs(dz)), it->second));
+        }
+    }
+    std::sort(wanted.begin(), wanted.end());
+
+    // Cells that may touch the player must be present, hence load them now if the loader did not finish them yet.
+    for (auto & w : wanted) {
+        if (w.first > near) break;
+        if (state.resident.count(w.second)) continue;
+        cell_ptr c = load_cell(state, w.second);
+        state.resident[w.second] = c;
+        state.resident_bytes += c->bytes;
+        state.stalls++;
+    }
+
+    // Evict cells that are out of reach, and the farthest cells while over budget.
+    std::vector<std::pair<int, uint32_t>> evictable;
+    for (auto & r : state.resident) {
+        const cellfile::cell_entry & e = state.index[r.first];
+        int d = std::max(std::abs(e.x - px), std::abs(e.z - pz));
+        if (d > near) evictable.push_back(std::make_pair(d, r.first));
+    }
+    std::sort(evictable.begin(), evictable.end());
+    while (!evictable.empty() && (evictable.back().first > radius + 1 || state.resident_bytes > state.budget)) {
+        auto r = state.resident.find(evictable.back().second);
+        state.resident_bytes -= r->second->bytes;
+        state.resident.erase(r);
+        evictable.pop_back();
+    }
+
+    // Request the missing cells, nearest first, as far as they fit in the budget.
+    state.requests.clear();
+    size_t bytes = state.resident_bytes;
+    for (auto & w : wanted) {
+        if (state.resident.count(w.second)) continue;
+        bytes += cell_bytes(state.index[w.second].blocks);
+        if (bytes > state.budget) break;
+        state.requests.push_back(w.second);
+    }
+    std::reverse(state.requests.begin(), state.requests.end());
+    lock.unlock();
+    if (!state.requests.empty()) state.wake.notify_one();
+    
+    scenery<cells>::collide(p);
+}
+
+// The cells that are handed to the render thread.
+static std::vector<cell_ptr> frames[3];
+
+template<>
+void scenery<cells>::publish(unsigned int f) {
+    frames[f].clear();
+    for (auto & r : active->resident) {
+        frames[f].push_back(r.second);
+    }
+}
+
+template<>
+void scenery<cells>::draw(unsigned int f) {
+    for (const cell_ptr & c : frames[f]) {
+        if (c->blocks.empty()) continue;
+        uint n = c->blocks.size();
+        c->coordinates.data()->attach();
+        glEnableClientState(GL_COLOR_ARRAY);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(1,1);
+        glDrawElements(GL_QUADS, n*24, GL_UNSIGNED_INT, c->face_indices.data());
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisableClientState(GL_COLOR_ARRAY);
+
+        glColor3f(0,0,0);
+        glLineWidth(2);
+        glDrawElements(GL_LINES, n*24, GL_UNSIGNED_INT, c->wire_indices.data());
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef SCENERY_CUBE_H
+#define SCENERY_CUBE_H
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include "../point_types.h"
+#include "../events.h"
+#include "scenery.h"
+
+// Geometry shared by the blocks and the static blocks streamed from cell files.
+
+static const short face_indices[] = {
+    1, 0, 2, 3,
+    4, 5, 7, 6,
+    0, 1, 5, 4,
+    3, 2, 6, 7,
+    2, 0, 4, 6,
+    1, 3, 7, 5,
+};
+static const short wire_indices[] = {
+    0,1,0,2,0,4,
+    1,3,1,5,
+    2,3,2,6,
+    3,7,
+    4,5,4,6,
+    5,7,
+    6,7,
+};
+
+static const glm::dvec3 cube_coords[] = {
+    glm::dvec3(-1,-1,-1),
+    glm::dvec3(-1,-1, 1),
+    glm::dvec3(-1, 1,-1),
+    glm::dvec3(-1, 1, 1),
+    glm::dvec3( 1,-1,-1),
+    glm::dvec3( 1,-1, 1),
+    glm::dvec3( 1, 1,-1),
+    glm::dvec3( 1, 1, 1),
+};
+
+/**
+ * Pushes the player out of a box, given by its rotation and its bounds in rotated coordinates,
+ * including the collision epsilon. Returns how far the player was moved.
+ * point_velocity(q) gives the velocity of the point q of the box, which the player takes over when standing on it.
+ * If node is not NULL, it is set to the point of the box that is nearest to the player.
+ */
+template<class V>
+inline double collide_box(const glm::dmat3 & rotation, const glm::dvec3 & lb, const glm::dvec3 & ub, player_state & p, point3f * node, V point_velocity) {
+    glm::dvec3 projected = rotation * glm::min(ub,glm::max(lb,p.position*rotation));
+    if (node) {
+        node->x = projected.x;
+        node->y = projected.y;
+        node->z = projected.z;
+    }
+    glm::dvec3 dist = projected - p.position;
+    double d = glm::dot(dist,dist);
+    if (1e-3 < d && d <= PLAYER_SIZE*PLAYER_SIZE) {
+        // Normalize dist
+        d = sqrt(d);
+        dist /= d;
+
+        // Move out of cube
+        p.position -= dist*(PLAYER_SIZE-d-COLLISION_EPSILON);
+
+        // Compute velocity of collision node
+        glm::dvec3 cn_vel = point_velocity(projected);
+
+        // Walking?
+        if (dist.y<-0.8) {
+            p.airborne = false;
+            p.velocity -= p.ground_vel;
+            p.ground_vel = cn_vel;
+            p.velocity += p.ground_vel;
+        }
+
+        // Change velocity to not be moving into the cube.
+        p.velocity -= dist*std::max(glm::dot(dist, p.velocity-cn_vel), 0.0);
+        return std::abs(PLAYER_SIZE-d-COLLISION_EPSILON);
+    }
+    return 0;
+}
+
+#endif
@@ -13,6 +13,7 @@ void (*fade_action)(struct lua_State*) = NULL;
 
 static const int FADE_DURATION = 60;
 static int fade_counter;
+static int frames[3];
 
 static point2s fade_coords[]= {
     {-1,-1},{1,-1},{1,1},{-1,1},  
@@ -30,7 +31,29 @@ void scenery<fade>::clear() {
 }
 
 template<>
-void scenery<fade>::draw() {
+void scenery<fade>::retain() {
+}
+
+template<>
+void scenery<fade>::swap() {
+}
+
+template<>
+void scenery<fade>::snapshot() {
+}
+
+template<>
+void scenery<fade>::restore() {
+}
+
+template<>
+void scenery<fade>::publish(unsigned int f) {
+    frames[f] = fade_counter;
+}
+
+template<>
+void scenery<fade>::draw(unsigned int f) {
+    int fade_counter = frames[f];
     if (fade_counter<=0) return;
     fade_coords->attach();
     glPushMatrix();
@@ -57,7 +80,7 @@ static void do_action(lua_State * L) {
 }
 
 template<>
-void scenery<fade>::interact(lua_State * L) {
+void scenery<fade>::interact(lua_State * L, player_state &) {
     switch(fade_state) {
         case FADE_STATES::FADE_OUT:
             if (fade_counter < FADE_DURATION) {
@@ -7,8 +7,11 @@
 #include "../point_types.h"
 #include "../events.h"
 #include "../luaX.h"
+#include "../bake.h"
 #include "scenery.h"
 #include "fade.h"
+#include "triggers.h"
+#include "sparks.h"
 
 struct gems;
 
@@ -18,17 +21,83 @@ static pointc lost_color[ENEMY_TRAIL];
 
 struct gem {
     glm::dvec3 position;
-    double rotation;
     bool taken;
     int action;
+    unsigned int trigger;
     char record_file[64];
+    // Gems are placed again on every reload, hence the record does not use the map arena.
     std::vector<point3f> record;
     bool not_yet_lost() {
-        return record.empty() || record.size() > move_counter+8;
+        return record.empty() || record.size() > player.move_counter+8;
     }
 };
 
-static std::vector<gem> gemlist;
+// The parts of a gem that can change after loading.
+struct gem_state {
+    bool taken;
+    int action;
+};
+
+struct gem_scenery {
+    std::vector<gem> gemlist;
+    // State after loading, used to restart the level.
+    std::vector<gem_state> initial_gems;
+    // Number of gems that the script of a baked map has placed so far.
+    unsigned int replayed_gems;
+    // All gems spin at the same rate.
+    double rotation;
+    double initial_rotation;
+};
+
+static gem_scenery buffers[2];
+static gem_scenery * active = &buffers[0];
+static gem_scenery * staged = &buffers[1];
+
+static gem_scenery & current() {
+    return use_staged_scenery ? *staged : *active;
+}
+
+template<>
+size_t scenery<gems>::memory() {
+    const gem_scenery & state = current();
+    size_t bytes = vector_bytes(state.gemlist) + vector_bytes(state.initial_gems);
+    for (const gem & g : state.gemlist) {
+        bytes += vector_bytes(g.record);
+    }
+    return bytes;
+}
+
+// The state of a gem that is handed to the render thread.
+struct drawn_gem {
+    glm::dvec3 position;
+    double rotation;
+    bool taken;
+    bool not_yet_lost;
+    // Part of the record that is visible, stored in gem_frame::trails.
+    bool has_trail;
+    uint trail_offset;
+    uint trail_length;
+    uint trail_color;
+    bool sparks;
+    point3f spark_position;
+    uint32_t spark_seed;
+};
+
+struct gem_frame {
+    std::vector<drawn_gem> gems;
+    std::vector<point3f> trails;
+    // Sparks of all ghosts, filled by the render thread.
+    std::vector<point3fc> sparks;
+};
+
+static gem_frame frames[3];
+
+// Layout of gems in baked maps.
+struct baked_gem {
+    glm::dvec3 position;
+    char record_file[64];
+    int32_t has_action;
+};
 
 static point3f gem_coords[] = {
     {  0, .2,  0},
@@ -50,11 +119,43 @@ static short gem_wire_indices[] = {
     1,5,2,5,3,5,4,5,
 };
 
+static void load_record(gem & g) {
+    char read_file[80];
+    snprintf(read_file, 80, "records/%s", g.record_file);
+    PHYSFS_File * r = PHYSFS_openRead(read_file);
+    if (r) {
+        int len = PHYSFS_fileLength(r) / sizeof(point3f);
+        g.record.resize(len);
+        PHYSFS_read(r, (void*)g.record.data(), sizeof(point3f), len);
+        PHYSFS_close(r);
+    }
+}
+
+static void take_gem(lua_State * L, unsigned int index, TRIGGER_EVENT event);
+
+// Gems are taken through a trigger, such that only the gems near the player are tested.
+static void add_gem_trigger(gem & g, unsigned int index) {
+    g.trigger = add_trigger_sphere(g.position, PLAYER_SIZE, take_gem, index);
+}
+
+static void set_action(lua_State * L, gem & g) {
+    if (luaX_check_field(L, 1, "action")) {
+        luaL_argcheck(L, lua_isfunction(L, -1), 1, "action must be a function");
+        g.action = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+}
+
 // place_gem(data{pos, record, action})
 static int place_gem(lua_State * L) {
+    gem_scenery & state = current();
+    std::vector<gem> & gemlist = state.gemlist;
+    if (replaying_baked_map) {
+        luaL_argcheck(L, state.replayed_gems<gemlist.size(), 1, "Script places more gems than its baked map.");
+        set_action(L, gemlist[state.replayed_gems++]);
+        return 0;
+    }
     gem g;
     g.taken = false;
-    g.rotation = 0;
     g.record_file[0] = 0;
     g.action = LUA_REFNIL;
     if (luaX_check_field(L, 1, "pos")) {
@@ -66,52 +167,162 @@ static int place_gem(lua_State * L) {
         luaL_argcheck(L, length<64, 1, "record path too long (max. 63 characters)");
         memcpy(g.record_file, record, length+1);
         lua_pop(L, 1);
-        
-        char read_file[80];
-        snprintf(read_file, 80, "records/%s", g.record_file);
-        PHYSFS_File * r = PHYSFS_openRead(read_file);
-        if (r) {
-            int len = PHYSFS_fileLength(r) / sizeof(point3f);
-            g.record.resize(len);
-            PHYSFS_read(r, (void*)g.record.data(), sizeof(point3f), len);
-            PHYSFS_close(r);
-        }
-    }
-    if (luaX_check_field(L, 1, "action")) {
-        luaL_argcheck(L, lua_isfunction(L, -1), 1, "action must be a function");
-        g.action = luaL_ref(L, LUA_REGISTRYINDEX);
+        load_record(g);
     }
+    set_action(L, g);
+    add_gem_trigger(g, gemlist.size());
    
     gemlist.push_back(std::move(g));
     return 0;
 }
 
-template<>
-void scenery<gems>::init(lua_State * L) {
+static bool init_trail_colors() {
     for (uint i=0; i<ENEMY_TRAIL; i++) {
         not_yet_lost_color[i].color = 0xffff00u + ((i*256/ENEMY_TRAIL)<<24u);
         lost_color[i].color = 0x0000ffu + ((i*256/ENEMY_TRAIL)<<24u);
     }
+    return true;
+}
+
+template<>
+void scenery<gems>::init(lua_State * L) {
+    // Initialized only once, as the next map can be loaded while the colors are in use.
+    static bool colors_initialized = init_trail_colors();
+    (void)colors_initialized;
     lua_register(L, "place_gem",  place_gem);
 }
 
 template<>
 void scenery<gems>::clear() {
+    current().gemlist.clear();
+    current().initial_gems.clear();
+    current().rotation = 0;
+}
+
+template<>
+void scenery<gems>::retain() {
+    std::vector<gem> & gemlist = current().gemlist;
+    // Actions refer to the old lua state, hence the gems are placed again.
     gemlist.clear();
 }
 
 template<>
-void scenery<gems>::draw() {
+void scenery<gems>::bake(bake::writer & w) {
+    std::vector<gem> & gemlist = current().gemlist;
+    std::vector<baked_gem> baked;
+    for (const gem & g : gemlist) {
+        baked_gem b = baked_gem();
+        b.position = g.position;
+        memcpy(b.record_file, g.record_file, sizeof(b.record_file));
+        b.has_action = g.action != LUA_REFNIL;
+        if (b.has_action) w.head.flags |= bake::SCRIPTED;
+        baked.push_back(b);
+    }
+    w.write(bake::GEMS, baked.data(), baked.size());
+}
+
+template<>
+bool scenery<gems>::unbake(const bake::reader & r) {
+    gem_scenery & state = current();
+    std::vector<gem> & gemlist = state.gemlist;
+    uint32_t n;
+    const baked_gem * baked = r.get<baked_gem>(bake::GEMS, n);
+    if (!baked) {
+        fprintf(stderr, "Baked gems have an incompatible layout\n");
+        return false;
+    }
+    gemlist.resize(n);
+    for (uint i=0; i<n; i++) {
+        gem & g = gemlist[i];
+        g.position = baked[i].position;
+        g.taken = false;
+        g.action = LUA_REFNIL;
+        add_gem_trigger(g, i);
+        memcpy(g.record_file, baked[i].record_file, sizeof(g.record_file));
+        g.record_file[63] = 0;
+        if (g.record_file[0]) load_record(g);
+    }
+    state.replayed_gems = 0;
+    return true;
+}
+
+template<>
+void scenery<gems>::swap() {
+    std::swap(active, staged);
+}
+
+template<>
+void scenery<gems>::snapshot() {
+    gem_scenery & state = current();
+    state.initial_gems.clear();
+    state.initial_rotation = state.rotation;
+    for (const gem & g : state.gemlist) {
+        gem_state s = {g.taken, g.action};
+        state.initial_gems.push_back(s);
+    }
+}
+
+template<>
+void scenery<gems>::restore() {
+    for (uint i=0; i<active->initial_gems.size(); i++) {
+        const gem_state & s = active->initial_gems[i];
+        gem & g = active->gemlist[i];
+        g.taken = s.taken;
+        g.action = s.action;
+    }
+    active->rotation = active->initial_rotation;
+}
+
+template<>
+void scenery<gems>::publish(unsigned int f) {
+    gem_frame & frame = frames[f];
+    frame.gems.clear();
+    frame.trails.clear();
+    uint move_counter = player.move_counter;
+    int first = std::max(0, (int)move_counter-ENEMY_TRAIL);
+    for (uint i=0; i<active->gemlist.size(); i++) {
+        gem & g = active->gemlist[i];
+        drawn_gem d;
+        d.position = g.position;
+        d.rotation = active->rotation;
+        d.taken = g.taken;
+        d.not_yet_lost = g.not_yet_lost();
+        d.has_trail = move_counter < g.record.size()+ENEMY_TRAIL;
+        d.trail_offset = frame.trails.size();
+        d.trail_length = 0;
+        d.trail_color = ENEMY_TRAIL-(int)move_counter+first;
+        d.sparks = false;
+        if (d.has_trail) {
+            int last = std::min(g.record.size(), (size_t)move_counter);
+            if (last > first) {
+                frame.trails.insert(frame.trails.end(), g.record.begin() + first, g.record.begin() + last);
+                d.trail_length = last - first;
+            }
+            if (0 < move_counter && move_counter <= g.record.size()) {
+                d.sparks = true;
+                d.spark_position = g.record[move_counter-1];
+                d.spark_position.y -= PLAYER_SIZE;
+                d.spark_seed = (i << 20) ^ move_counter;
+            }
+        }
+        frame.gems.push_back(d);
+    }
+}
+
+template<>
+void scenery<gems>::draw(unsigned int f) {
+    gem_frame & frame = frames[f];
+    std::vector<drawn_gem> & gemlist = frame.gems;
     gem_coords->attach();
     
     // Draw gems outlines
     glLineWidth(1);
-    for (gem & g : gemlist) {
+    for (drawn_gem & g : gemlist) {
         if (!g.taken) {
             glPushMatrix();
             glTranslated(g.position.x, g.position.y, g.position.z);
             glRotated(g.rotation,0,1,0);
-            if (g.not_yet_lost()) glColor3f(0,1,1);
+            if (g.not_yet_lost) glColor3f(0,1,1);
             else glColor3f(1,0,0);
             glDrawElements(GL_LINES, 24, GL_UNSIGNED_SHORT, gem_wire_indices);
             glPopMatrix();
@@ -122,12 +333,12 @@ void scenery<gems>::draw() {
     glEnable(GL_BLEND);
     glEnable(GL_POLYGON_OFFSET_FILL);
     glPolygonOffset(1,1);
-    for (gem & g : gemlist) {
+    for (drawn_gem & g : gemlist) {
         if (!g.taken) {
             glPushMatrix();
             glTranslated(g.position.x, g.position.y, g.position.z);
             glRotated(g.rotation,0,1,0);
-            if (g.not_yet_lost()) glColor4f(0,1,1,0.5);
+            if (g.not_yet_lost) glColor4f(0,1,1,0.5);
             else glColor4f(1,0,0,0.5);
             glDrawElements(GL_TRIANGLES, 24, GL_UNSIGNED_SHORT, gem_face_indices);
             glPopMatrix();
@@ -138,70 +349,51 @@ void scenery<gems>::draw() {
 
     // Draw records
     glLineWidth(5);
-    int first = std::max(0, (int)move_counter-ENEMY_TRAIL);
     glEnable(GL_BLEND);
     glEnableClientState(GL_COLOR_ARRAY);
-    point3fc sparks[64];
-    float IRM = 1. / RAND_MAX;
     glDepthMask(false);
-    for (gem & g : gemlist) {
-        if (move_counter >= g.record.size()+ENEMY_TRAIL) continue;
-        glPushMatrix();
-        glTranslated(0,-PLAYER_SIZE,0);
-        int last = std::min(g.record.size(), (size_t)move_counter);
-        if (g.not_yet_lost()) not_yet_lost_color[ENEMY_TRAIL-(int)move_counter].attach();
-        else lost_color[ENEMY_TRAIL-(int)move_counter].attach();
-        g.record.data()->attach();
-        glDrawArrays(GL_LINE_STRIP, first, last-first);
-        
-        if (0 < move_counter && move_counter <= g.record.size()) {
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-            glLineWidth(3);
-            point3f pos = g.record[move_counter-1];
-            glTranslated(pos.x,pos.y,pos.z);
-            for (int i=0; i<32; i++) {
-                uint base_color = rand()&0xffffff;
-                sparks[i*2] = {0,0,0, 0xff000000 | base_color};
-                float x,y,z;
-                do {x=rand()*IRM-0.5;y=rand()*IRM-0.5;z=rand()*IRM-0.5;} while (x*x+y*y+z*z>0.25);
-                sparks[i*2+1] = {x,y,z, base_color};
-                
-            }
-            sparks->attach();
-            glDrawArrays(GL_LINES, 0, 64);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glPushMatrix();
+    glTranslated(0,-PLAYER_SIZE,0);
+    frame.sparks.clear();
+    for (drawn_gem & g : gemlist) {
+        if (g.trail_length > 0) {
+            if (g.not_yet_lost) not_yet_lost_color[g.trail_color].attach();
+            else lost_color[g.trail_color].attach();
+            frame.trails[g.trail_offset].attach();
+            glDrawArrays(GL_LINE_STRIP, 0, g.trail_length);
         }
-        glPopMatrix();
+        if (g.sparks) sparks::add(frame.sparks, g.spark_position, g.spark_seed);
     }
+    glPopMatrix();
     glDepthMask(true);
     glDisableClientState(GL_COLOR_ARRAY);
     glDisable(GL_BLEND);
+    sparks::draw(frame.sparks);
 }
 
-template<>
-void scenery<gems>::interact(lua_State * L) {
-    for (gem &g : gemlist) {
-        if (!g.taken) {
-            g.rotation += 5;
-            glm::dvec3 gem_dist = g.position - position;
-            if (glm::dot(gem_dist,gem_dist) < PLAYER_SIZE*PLAYER_SIZE) {
-                g.taken = true;
-                if (g.record_file[0] && g.not_yet_lost()) {
-                    printf("Saving record for gem '%s'\n", g.record_file);
-                    finish(g.position + glm::dvec3(0,PLAYER_SIZE,0), g.record_file);
-                }
-                if (g.action != LUA_REFNIL) {
-                    lua_rawgeti(L, LUA_REGISTRYINDEX, g.action);
-                    luaL_unref(L, LUA_REGISTRYINDEX, g.action);
-                    g.action = LUA_REFNIL;
-                    
-                    if (lua_pcall(L, 0, 0, 0) != 0) {
-                        fprintf(stderr, "error running action for gem '%s': %s\n", g.record_file, lua_tostring(L, -1));
-                        lua_pop(L, 1);
-                    }
-                }
-            }
+static void take_gem(lua_State * L, unsigned int index, TRIGGER_EVENT event) {
+    if (event != TRIGGER_EVENT::ENTER) return;
+    gem & g = active->gemlist[index];
+    g.taken = true;
+    enable_trigger(g.trigger, false);
+    if (g.record_file[0] && g.not_yet_lost()) {
+        printf("Saving record for gem '%s'\n", g.record_file);
+        finish(g.position + glm::dvec3(0,PLAYER_SIZE,0), g.record_file);
+    }
+    if (g.action != LUA_REFNIL) {
+        // The action stays referenced, as it is needed again when the level is restarted.
+        lua_rawgeti(L, LUA_REGISTRYINDEX, g.action);
+        g.action = LUA_REFNIL;
+        
+        if (lua_pcall(L, 0, 0, 0) != 0) {
+            fprintf(stderr, "error running action for gem '%s': %s\n", g.record_file, lua_tostring(L, -1));
+            lua_pop(L, 1);
         }
     }
 }
 
+template<>
+void scenery<gems>::interact(lua_State *, player_state &) {
+    // Taking gems is handled by scenery<triggers>.
+    active->rotation += 5;
+}
@@ -1,22 +1,69 @@
+#define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
+#include <GL/glext.h>
+#include <cmath>
+#include <vector>
+#include <algorithm>
 
 #include "../point_types.h"
 #include "../events.h"
 #include "scenery.h"
+#include "grid.h"
 
-static const int GRID_SIZE = 1023;
-static point3s grid_array[GRID_SIZE * 4];
+int grid_radius = 64;
+
+// Resolution of the texture that fades out the grid.
+static const int FADE_SIZE = 64;
+
+// The lines of a square part of the grid, centered at the origin. It is moved along with the camera.
+static GLuint grid_buffer;
+static int grid_vertices;
+static int buffer_radius;
+static GLuint fade_texture;
 
 struct grid;
 
+// Called from the render thread, as it requires the GL context.
+static void upload_grid() {
+    int r = grid_radius;
+    std::vector<point3s> lines;
+    for (int i=-r; i<=r; i++) {
+        lines.push_back({(short)-r,0,(short)i});
+        lines.push_back({(short)+r,0,(short)i});
+        lines.push_back({(short)i,0,(short)-r});
+        lines.push_back({(short)i,0,(short)+r});
+    }
+    if (!grid_buffer) glGenBuffers(1, &grid_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, grid_buffer);
+    glBufferData(GL_ARRAY_BUFFER, lines.size() * sizeof(point3s), lines.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    grid_vertices = lines.size();
+    buffer_radius = r;
+
+    if (fade_texture) return;
+    // Alpha that decreases from the center to the edge of the texture.
+    unsigned char alpha[FADE_SIZE * FADE_SIZE];
+    for (int y=0; y<FADE_SIZE; y++) {
+        for (int x=0; x<FADE_SIZE; x++) {
+            double dx = (x + 0.5) * 2 / FADE_SIZE - 1;
+            double dy = (y + 0.5) * 2 / FADE_SIZE - 1;
+            double f = std::max(0.0, 1 - std::sqrt(dx*dx + dy*dy));
+            alpha[y*FADE_SIZE+x] = 255 * std::min(1.0, 2 * f);
+        }
+    }
+    glGenTextures(1, &fade_texture);
+    glBindTexture(GL_TEXTURE_2D, fade_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, FADE_SIZE, FADE_SIZE, 0, GL_ALPHA, GL_UNSIGNED_BYTE, alpha);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 template<>
 void scenery<grid>::init(lua_State*) {
-    for (int i=0; i<GRID_SIZE; i++) {
-        grid_array[4*i+0]={-GRID_SIZE/2,0,(short)(i-GRID_SIZE/2)};
-        grid_array[4*i+1]={+GRID_SIZE/2,0,(short)(i-GRID_SIZE/2)};
-        grid_array[4*i+2]={(short)(i-GRID_SIZE/2),0,-GRID_SIZE/2};
-        grid_array[4*i+3]={(short)(i-GRID_SIZE/2),0, GRID_SIZE/2};
-    }
+    // The grid is uploaded by the render thread when it is first drawn.
 }
 
 template<>
@@ -24,24 +71,76 @@ void scenery<grid>::clear() {
 }
 
 template<>
-void scenery<grid>::draw() {
-    grid_array->attach();
+void scenery<grid>::retain() {
+}
+
+template<>
+void scenery<grid>::swap() {
+}
+
+template<>
+void scenery<grid>::snapshot() {
+}
+
+template<>
+void scenery<grid>::restore() {
+}
+
+template<>
+void scenery<grid>::publish(unsigned int) {
+}
+
+template<>
+void scenery<grid>::draw(unsigned int) {
+    if (buffer_radius != grid_radius) upload_grid();
+    // The grid is moved by whole units, such that its lines stay in place.
+    double cx = std::floor(camera_position.x);
+    double cz = std::floor(camera_position.z);
+    double scale = 0.5 / buffer_radius;
+    // Texture coordinates such that the fade is centered at the camera.
+    GLdouble plane_s[] = {scale, 0, 0, 0.5 - (camera_position.x - cx) * scale};
+    GLdouble plane_t[] = {0, 0, scale, 0.5 - (camera_position.z - cz) * scale};
+    glTexGeni(GL_S, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR);
+    glTexGeni(GL_T, GL_TEXTURE_GEN_MODE, GL_OBJECT_LINEAR);
+    glTexGendv(GL_S, GL_OBJECT_PLANE, plane_s);
+    glTexGendv(GL_T, GL_OBJECT_PLANE, plane_t);
+    glEnable(GL_TEXTURE_GEN_S);
+    glEnable(GL_TEXTURE_GEN_T);
+    glBindTexture(GL_TEXTURE_2D, fade_texture);
+    glEnable(GL_TEXTURE_2D);
+    
+    glPushMatrix();
+    glTranslated(cx, 0, cz);
+    glBindBuffer(GL_ARRAY_BUFFER, grid_buffer);
+    glVertexPointer(3, GL_SHORT, sizeof(point3s), 0);
     glColor4f(0,1,0, 0.3);
     glEnable(GL_BLEND);
     glDisable(GL_DEPTH_TEST);
     glLineWidth(1);
-    glDrawArrays(GL_LINES, 0, GRID_SIZE*4);
+    glDrawArrays(GL_LINES, 0, grid_vertices);
     glEnable(GL_DEPTH_TEST);
     glDisable(GL_BLEND);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glPopMatrix();
+    
+    glDisable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_TEXTURE_GEN_S);
+    glDisable(GL_TEXTURE_GEN_T);
 }
 
 template<>
-void scenery<grid>::interact(lua_State*) {
+void scenery<grid>::collide(player_state & p) {
     // Ground collision.
-    if (position.y <= PLAYER_SIZE + COLLISION_EPSILON) {
-        position.y = PLAYER_SIZE;
-        velocity.y = 0;
-        airborne = false;
-        ground_vel = glm::dvec3(0,0,0);
+    if (p.position.y <= PLAYER_SIZE + COLLISION_EPSILON) {
+        p.position.y = PLAYER_SIZE;
+        p.velocity.y = 0;
+        p.airborne = false;
+        p.ground_vel = glm::dvec3(0,0,0);
     }
 }
+
+template<>
+void scenery<grid>::interact(lua_State*, player_state & p) {
+    collide(p);
+}
@@ -0,0 +1,7 @@
+#ifndef SCENERY_GRID_H
+#define SCENERY_GRID_H
+
+/** Distance from the camera up to which the ground grid is drawn. It fades out towards this distance. */
+extern int grid_radius;
+
+#endif 
@@ -19,17 +19,84 @@
 #ifndef SCENERY_H
 #define SCENERY_H
 
+#include <vector>
+#include <cstddef>
+#include <glm/glm.hpp>
+
 struct lua_State;
+struct player_state;
+namespace bake {
+    struct writer;
+    struct reader;
+}
+namespace spectate {
+    struct writer;
+}
+namespace cellfile {
+    struct block;
+}
 
 static const double PLAYER_SIZE = 0.4; 
 static const double COLLISION_EPSILON = 0.002;
 
+/** 
+ * Set while the script of a baked map is executed. The scenery it constructs
+ * already exists, so only the ids, tick function and actions must be obtained. 
+ */
+extern thread_local bool replaying_baked_map;
+
+/**
+ * Set on the thread that loads the next map in the background.
+ * The functions called by its map script then act on the staged scenery instead of the active one.
+ */
+extern thread_local bool use_staged_scenery;
+
 template<class T>
 struct scenery {
     static void init(lua_State *);
     static void clear();
-    static void draw();
-    static void interact(lua_State * L);
+    /** Prepares for reloading the map script, keeping state that can be reused. */
+    static void retain();
+    /** Exchanges the staged and active scenery. */
+    static void swap();
+    /** Stores the state right after loading, such that the level can be restarted. */
+    static void snapshot();
+    /** Restores the state stored by snapshot(). */
+    static void restore();
+    /** 
+     * Keeps track of the changes made in each move. If the move counter decreased, 
+     * undoes the changes of the later moves and returns true if this restored the state exactly.
+     */
+    static bool rewind(unsigned int move);
+    /** Copies the state needed for drawing to the given frame, which is then handed to the render thread. */
+    static void publish(unsigned int frame);
+    /** Draws the given frame. This is called from the render thread. */
+    static void draw(unsigned int frame);
+    /** Updates the scenery for a simulation step and lets it act on the player. */
+    static void interact(lua_State * L, player_state & p);
+    /** 
+     * Pushes the player out of the scenery. This does not change the scenery, 
+     * hence it can be called for many players in parallel.
+     */
+    static void collide(player_state & p);
+    /** Writes the state after loading the map script to a baked map. */
+    static void bake(bake::writer & w);
+    /** Restores the state from a baked map. */
+    static bool unbake(const bake::reader & r);
+    /** Adds the changes of the last simulation step to the spectator stream, or everything if w.full is set. */
+    static void spectate(spectate::writer & w);
+    /** Appends the blocks that never move to the given list, such that they can be streamed from a cell file. */
+    static void export_cells(std::vector<cellfile::block> & out);
+    /** Obtains the position and velocity of a block of the active scene. Returns false if there is no such block. */
+    static bool block_motion(unsigned int id, glm::dvec3 & position, glm::dvec3 & velocity);
+    /** Returns the number of bytes allocated for the scenery. */
+    static size_t memory();
 };
 
+/** Number of bytes allocated by a vector. */
+template<class T, class A>
+inline size_t vector_bytes(const std::vector<T, A> & v) {
+    return v.capacity() * sizeof(T);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include <GL/gl.h>
+
+#include "../xorshift.h"
+#include "sparks.h"
+
+// Number of sparks in a burst.
+static const int SPARKS = 32;
+// Number of different bursts.
+static const int PATTERNS = 64;
+
+// Each spark is a line from the center, which is opaque, to a point within a sphere of radius 0.5, which is transparent.
+static point3fc patterns[PATTERNS][SPARKS * 2];
+
+static bool init_patterns() {
+    xorshift random(1);
+    for (int p=0; p<PATTERNS; p++) {
+        for (int i=0; i<SPARKS; i++) {
+            uint32_t base_color = random.next() & 0xffffff;
+            float x,y,z;
+            do {
+                x = random.uniform(-0.5, 0.5);
+                y = random.uniform(-0.5, 0.5);
+                z = random.uniform(-0.5, 0.5);
+            } while (x*x+y*y+z*z>0.25);
+            patterns[p][i*2]   = {0,0,0, 0xff000000 | base_color};
+            patterns[p][i*2+1] = {x,y,z, base_color};
+        }
+    }
+    return true;
+}
+
+void sparks::add(std::vector<point3fc> & batch, const point3f & position, uint32_t seed) {
+    // Generated on first use, which is on the render thread.
+    static bool initialized = init_patterns();
+    (void)initialized;
+    // Mixes the seed, such that consecutive seeds select unrelated patterns.
+    const point3fc * pattern = patterns[xorshift(seed * 0x9e3779b9u).next() % PATTERNS];
+    for (int i=0; i<SPARKS*2; i++) {
+        point3fc v = pattern[i];
+        v.x += position.x;
+        v.y += position.y;
+        v.z += position.z;
+        batch.push_back(v);
+    }
+}
+
+void sparks::draw(const std::vector<point3fc> & batch) {
+    if (batch.empty()) return;
+    glEnable(GL_BLEND);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    glDepthMask(false);
+    glLineWidth(3);
+    batch.front().attach();
+    glDrawArrays(GL_LINES, 0, batch.size());
+    glDepthMask(true);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisable(GL_BLEND);
+}
@@ -0,0 +1,19 @@
+#ifndef SCENERY_SPARKS_H
+#define SCENERY_SPARKS_H
+
+#include <vector>
+#include <cstdint>
+#include "../point_types.h"
+
+/**
+ * Bursts of sparks, taken from a pool of patterns that is generated once.
+ * The bursts of a frame are collected in a batch and drawn with a single draw call.
+ */
+namespace sparks {
+    /** Adds a burst at the given position to the batch. The seed selects the pattern, such that drawing is deterministic. */
+    void add(std::vector<point3fc> & batch, const point3f & position, uint32_t seed);
+    /** Draws all bursts in the batch. */
+    void draw(const std::vector<point3fc> & batch);
+}
+
+#endif 
@@ -0,0 +1,288 @@
+#include <vector>
+#include <unordered_map>
+#include <cmath>
+#include <lua.hpp>
+
+#include "../events.h"
+#include "../luaX.h"
+#include "../bake.h"
+#include "scenery.h"
+#include "triggers.h"
+
+struct triggers;
+
+// Edge length of the cells of the trigger index.
+static const double CELL_SIZE = 8;
+// Triggers that cover more cells than this are tested in every step instead.
+static const unsigned int MAX_CELLS = 64;
+
+struct trigger {
+    glm::dvec3 center;
+    // Half size of the box, or of the bounding box of a sphere.
+    glm::dvec3 half;
+    // Radius of a sphere, or 0 for a box.
+    double radius;
+    bool enabled;
+    // Whether the player was inside during the last step.
+    bool inside;
+    // Step in which the player was last found inside.
+    unsigned int seen;
+    // Lua functions called for each event, or LUA_REFNIL.
+    int enter;
+    int stay;
+    int exit;
+    // Set for triggers placed by other scenery.
+    trigger_handler handler;
+    unsigned int owner;
+};
+
+struct trigger_event {
+    unsigned int id;
+    TRIGGER_EVENT event;
+};
+
+struct trigger_scenery {
+    std::vector<trigger> list;
+    // Enabled state after loading, used to restart the level.
+    std::vector<bool> initial_enabled;
+    // Triggers per cell, rebuilt when triggers are added.
+    bool indexed;
+    std::unordered_map<uint64_t, std::vector<unsigned int>> cells;
+    std::vector<unsigned int> large;
+    // Triggers that contained the player during the last step.
+    std::vector<unsigned int> inside;
+    std::vector<unsigned int> found;
+    std::vector<trigger_event> events;
+    unsigned int step;
+};
+
+static trigger_scenery buffers[2];
+static trigger_scenery * active = &buffers[0];
+static trigger_scenery * staged = &buffers[1];
+
+static trigger_scenery & current() {
+    return use_staged_scenery ? *staged : *active;
+}
+
+static uint64_t cell_key(int x, int y, int z) {
+    const uint64_t mask = (1 << 21) - 1;
+    return ((uint64_t)(x & mask) << 42) | ((uint64_t)(y & mask) << 21) | (uint64_t)(z & mask);
+}
+
+static int cell_of(double coordinate) {
+    return (int)std::floor(coordinate / CELL_SIZE);
+}
+
+static void build_index(trigger_scenery & state) {
+    state.cells.clear();
+    state.large.clear();
+    for (uint id=0; id<state.list.size(); id++) {
+        const trigger & t = state.list[id];
+        glm::dvec3 lo = t.center - t.half, hi = t.center + t.half;
+        int x0 = cell_of(lo.x), y0 = cell_of(lo.y), z0 = cell_of(lo.z);
+        int x1 = cell_of(hi.x), y1 = cell_of(hi.y), z1 = cell_of(hi.z);
+        if ((uint64_t)(x1-x0+1)*(y1-y0+1)*(z1-z0+1) > MAX_CELLS) {
+            state.large.push_back(id);
+            continue;
+        }
+        for (int x=x0; x<=x1; x++) for (int y=y0; y<=y1; y++) for (int z=z0; z<=z1; z++) {
+            state.cells[cell_key(x,y,z)].push_back(id);
+        }
+    }
+    state.indexed = true;
+}
+
+static bool contains(const trigger & t, const glm::dvec3 & p) {
+    glm::dvec3 d = p - t.center;
+    if (t.radius > 0) return glm::dot(d, d) < t.radius * t.radius;
+    return std::abs(d.x) <= t.half.x && std::abs(d.y) <= t.half.y && std::abs(d.z) <= t.half.z;
+}
+
+static unsigned int add_trigger(const trigger & t) {
+    trigger_scenery & state = current();
+    state.list.push_back(t);
+    state.indexed = false;
+    return state.list.size() - 1;
+}
+
+unsigned int add_trigger_sphere(const glm::dvec3 & center, double radius, trigger_handler handler, unsigned int owner) {
+    trigger t = trigger();
+    t.center = center;
+    t.half = glm::dvec3(radius);
+    t.radius = radius;
+    t.enabled = true;
+    t.enter = t.stay = t.exit = LUA_REFNIL;
+    t.handler = handler;
+    t.owner = owner;
+    return add_trigger(t);
+}
+
+void enable_trigger(unsigned int id, bool enabled) {
+    trigger_scenery & state = current();
+    if (id < state.list.size()) state.list[id].enabled = enabled;
+}
+
+static int get_callback(lua_State * L, const char * name) {
+    if (!luaX_check_field(L, 1, name)) return LUA_REFNIL;
+    luaL_argcheck(L, lua_isfunction(L, -1), 1, "trigger events must be functions");
+    return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+// place_trigger(data{pos, radius or size, enter, stay, exit}) : id
+static int place_trigger(lua_State * L) {
+    trigger t = trigger();
+    t.enabled = true;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    if (luaX_check_field(L, 1, "pos")) {
+        t.center = luaX_get_vector(L);
+    }
+    if (luaX_check_field(L, 1, "radius")) {
+        t.radius = luaL_checknumber(L, -1);
+        lua_pop(L, 1);
+        luaL_argcheck(L, t.radius > 0, 1, "radius must be positive");
+        t.half = glm::dvec3(t.radius);
+    } else if (luaX_check_field(L, 1, "size")) {
+        t.half = glm::abs(luaX_get_vector(L));
+    } else {
+        return luaL_argerror(L, 1, "trigger needs a radius or size");
+    }
+    t.enter = get_callback(L, "enter");
+    t.stay  = get_callback(L, "stay");
+    t.exit  = get_callback(L, "exit");
+    lua_pushinteger(L, add_trigger(t));
+    return 1;
+}
+
+// enable_trigger(id, enabled)
+static int lua_enable_trigger(lua_State * L) {
+    unsigned int id = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, id < current().list.size(), 1, "invalid trigger id");
+    enable_trigger(id, lua_toboolean(L, 2));
+    return 0;
+}
+
+template<>
+void scenery<triggers>::init(lua_State * L) {
+    lua_register(L, "place_trigger",  place_trigger);
+    lua_register(L, "enable_trigger", lua_enable_trigger);
+}
+
+template<>
+void scenery<triggers>::clear() {
+    trigger_scenery & state = current();
+    state.list.clear();
+    state.initial_enabled.clear();
+    state.cells.clear();
+    state.large.clear();
+    state.inside.clear();
+    state.events.clear();
+    state.indexed = false;
+}
+
+template<>
+void scenery<triggers>::retain() {
+    // Both the Lua functions and the gems are placed again by the script.
+    clear();
+}
+
+template<>
+void scenery<triggers>::swap() {
+    std::swap(active, staged);
+}
+
+template<>
+void scenery<triggers>::snapshot() {
+    trigger_scenery & state = current();
+    state.initial_enabled.clear();
+    for (const trigger & t : state.list) {
+        state.initial_enabled.push_back(t.enabled);
+    }
+}
+
+template<>
+void scenery<triggers>::restore() {
+    for (uint i=0; i<active->initial_enabled.size(); i++) {
+        active->list[i].enabled = active->initial_enabled[i];
+        active->list[i].inside = false;
+    }
+    active->inside.clear();
+}
+
+template<>
+void scenery<triggers>::bake(bake::writer & w) {
+    // Triggers are not stored, those of the script are placed again when it is replayed.
+    for (const trigger & t : current().list) {
+        if (!t.handler) w.head.flags |= bake::SCRIPTED;
+    }
+}
+
+template<>
+size_t scenery<triggers>::memory() {
+    const trigger_scenery & state = current();
+    size_t bytes = vector_bytes(state.list) + state.initial_enabled.capacity() / 8;
+    for (const auto & cell : state.cells) {
+        bytes += sizeof(cell) + vector_bytes(cell.second);
+    }
+    return bytes;
+}
+
+static void emit(trigger_scenery & state, unsigned int id, TRIGGER_EVENT event) {
+    const trigger & t = state.list[id];
+    int callback = event == TRIGGER_EVENT::ENTER ? t.enter : event == TRIGGER_EVENT::STAY ? t.stay : t.exit;
+    if (t.handler || callback != LUA_REFNIL) {
+        trigger_event e = {id, event};
+        state.events.push_back(e);
+    }
+}
+
+template<>
+void scenery<triggers>::interact(lua_State * L, player_state & p) {
+    trigger_scenery & state = *active;
+    if (!state.indexed) build_index(state);
+    state.step++;
+
+    // Find the triggers that contain the player, testing only those of its cell.
+    state.found.clear();
+    auto test = [&](unsigned int id) {
+        trigger & t = state.list[id];
+        if (t.enabled && contains(t, p.position)) {
+            t.seen = state.step;
+            state.found.push_back(id);
+        }
+    };
+    for (unsigned int id : state.large) test(id);
+    auto cell = state.cells.find(cell_key(cell_of(p.position.x), cell_of(p.position.y), cell_of(p.position.z)));
+    if (cell != state.cells.end()) {
+        for (unsigned int id : cell->second) test(id);
+    }
+
+    // Collect the events first, such that the callbacks can add and change triggers.
+    state.events.clear();
+    for (unsigned int id : state.inside) {
+        trigger & t = state.list[id];
+        if (t.seen == state.step) continue;
+        t.inside = false;
+        if (t.enabled) emit(state, id, TRIGGER_EVENT::EXIT);
+    }
+    for (unsigned int id : state.found) {
+        trigger & t = state.list[id];
+        emit(state, id, t.inside ? TRIGGER_EVENT::STAY : TRIGGER_EVENT::ENTER);
+        t.inside = true;
+    }
+    state.inside.swap(state.found);
+
+    for (const trigger_event & e : state.events) {
+        const trigger & t = state.list[e.id];
+        if (t.handler) {
+            t.handler(L, t.owner, e.event);
+            continue;
+        }
+        int callback = e.event == TRIGGER_EVENT::ENTER ? t.enter : e.event == TRIGGER_EVENT::STAY ? t.stay : t.exit;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, callback);
+        lua_pushinteger(L, e.id);
+        if (lua_pcall(L, 1, 0, 0) != 0) {
+            fprintf(stderr, "error running event of trigger %u: %s\n", e.id, lua_tostring(L, -1));
+            lua_pop(L, 1);
+        }
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef SCENERY_TRIGGERS_H
+#define SCENERY_TRIGGERS_H
+
+#include <glm/glm.hpp>
+
+struct lua_State;
+
+enum class TRIGGER_EVENT {
+    ENTER,
+    STAY,
+    EXIT
+};
+
+/** Receives the events of triggers that are placed by other scenery, such as gems. */
+typedef void (*trigger_handler)(lua_State * L, unsigned int owner, TRIGGER_EVENT event);
+
+/**
+ * Adds a spherical trigger to the scenery that is being loaded and returns its id.
+ * The handler is called with the given owner after the collisions of each step.
+ */
+unsigned int add_trigger_sphere(const glm::dvec3 & center, double radius, trigger_handler handler, unsigned int owner);
+
+/** Enables or disables a trigger. A disabled trigger emits no events, not even an exit event. */
+void enable_trigger(unsigned int id, bool enabled);
+
+#endif
@@ -0,0 +1,148 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <vector>
+#include <algorithm>
+
+#include "spectate.h"
+#include "events.h"
+#include "scenery/scenery.h"
+
+struct blocks;
+
+// Size of the send buffer of each spectator, which determines how far it can fall behind.
+static const int SEND_BUFFER = 1 << 20;
+
+struct spectator {
+    int fd;
+    bool needs_keyframe;
+};
+
+static int listener = -1;
+static char socket_file[108];
+static std::vector<spectator> spectators;
+static uint32_t tick_counter;
+static spectate::writer updates;
+static std::vector<char> packet;
+
+bool spectate::start(const char * socket_path) {
+    stop();
+    sockaddr_un address = sockaddr_un();
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Spectator socket path too long: %s\n", socket_path);
+        return false;
+    }
+    strcpy(address.sun_path, socket_path);
+    listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        fprintf(stderr, "Failed to create spectator socket: %s\n", strerror(errno));
+        return false;
+    }
+    unlink(socket_path);
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 4) != 0) {
+        fprintf(stderr, "Failed to listen on '%s': %s\n", socket_path, strerror(errno));
+        close(listener);
+        listener = -1;
+        return false;
+    }
+    strcpy(socket_file, socket_path);
+    return true;
+}
+
+void spectate::stop() {
+    if (listener < 0) return;
+    for (const spectator & s : spectators) close(s.fd);
+    spectators.clear();
+    close(listener);
+    unlink(socket_file);
+    listener = -1;
+}
+
+// Sends the updates in packets. Returns false if the spectator could not keep up or disconnected.
+static bool send_tick(int fd, const spectate::packet_header & base, const spectate::writer & w) {
+    uint32_t sent = 0;
+    do {
+        uint32_t n = std::min<uint32_t>(w.updates.size() - sent, spectate::MAX_UPDATES_PER_PACKET);
+        spectate::packet_header header = base;
+        header.updates = n;
+        if (sent == 0) header.flags |= spectate::FIRST_PACKET;
+        if (sent + n == w.updates.size()) header.flags |= spectate::LAST_PACKET;
+        size_t size = sizeof(header) + n*sizeof(spectate::block_update);
+        packet.resize(size);
+        memcpy(packet.data(), &header, sizeof(header));
+        memcpy(packet.data() + sizeof(header), w.updates.data() + sent, n*sizeof(spectate::block_update));
+        if (send(fd, packet.data(), size, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)size) {
+            return false;
+        }
+        sent += n;
+    } while (sent < w.updates.size());
+    return true;
+}
+
+void spectate::tick() {
+    if (listener < 0) return;
+    tick_counter++;
+    
+    // Accept new spectators.
+    int fd;
+    while ((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &SEND_BUFFER, sizeof(SEND_BUFFER));
+        spectator s = {fd, true};
+        spectators.push_back(s);
+    }
+    
+    if (spectators.empty()) return;
+    
+    // Collect the changes, or all blocks if any spectator needs a keyframe.
+    updates.full = false;
+    for (const spectator & s : spectators) updates.full |= s.needs_keyframe;
+    updates.updates.clear();
+    scenery<blocks>::spectate(updates);
+    
+    packet_header header = packet_header();
+    header.tick = tick_counter;
+    header.flags = updates.full ? KEYFRAME : 0;
+    header.blocks = updates.blocks;
+    header.move_counter = player.move_counter;
+    for (int i=0; i<3; i++) {
+        header.position[i] = player.position[i];
+        header.velocity[i] = player.velocity[i];
+    }
+    
+    uint j = 0;
+    for (spectator & s : spectators) {
+        if (send_tick(s.fd, header, updates)) {
+            s.needs_keyframe = false;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // Drop the tick for this spectator.
+            s.needs_keyframe = true;
+        } else {
+            close(s.fd);
+            continue;
+        }
+        spectators[j++] = s;
+    }
+    spectators.resize(j);
+}
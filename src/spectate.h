@@ -0,0 +1,72 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPECTATE_H
+#define SPECTATE_H
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Streams the state after every simulation step to spectators, which connect to a UNIX seqpacket socket.
+ * A tick consists of one or more packets, each a packet_header followed by block_updates.
+ * Normally only the blocks that changed during the step are sent. A keyframe contains all blocks 
+ * and is sent to new spectators, after the scene changed, and after a spectator was too slow
+ * to receive a packet, in which case its packets were dropped.
+ */
+namespace spectate {
+    enum {
+        KEYFRAME = 1,
+        FIRST_PACKET = 2,
+        LAST_PACKET = 4,
+    };
+    
+    static const unsigned int MAX_UPDATES_PER_PACKET = 1024;
+    
+    struct packet_header {
+        uint32_t tick;
+        uint32_t flags;
+        uint32_t blocks;
+        uint32_t updates;
+        uint32_t move_counter;
+        float position[3];
+        float velocity[3];
+    };
+    
+    struct block_update {
+        uint32_t index;
+        uint32_t color;
+        float position[3];
+        float rotation[4]; // quaternion (w,x,y,z)
+        float size[3];
+    };
+    
+    /** Collects the block updates of a tick. */
+    struct writer {
+        /** Whether all blocks must be sent. Set by the scenery if the scene changed. */
+        bool full;
+        uint32_t blocks;
+        std::vector<block_update> updates;
+    };
+    
+    bool start(const char * socket_path);
+    void stop();
+    /** Sends the state after a simulation step to the spectators. This never blocks. */
+    void tick();
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../spectate.h"
+
+/**
+ * Minimal spectator, which mirrors the streamed blocks and prints a line per tick.
+ */
+int main(int argc, const char ** argv) {
+    if (argc != 2) {
+        printf("Usage: %s socket\n", argv[0]);
+        return 1;
+    }
+    sockaddr_un address = sockaddr_un();
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, argv[1], sizeof(address.sun_path)-1);
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        perror("Failed to connect");
+        return 1;
+    }
+    
+    std::vector<spectate::block_update> mirror;
+    std::vector<char> buffer(sizeof(spectate::packet_header) + spectate::MAX_UPDATES_PER_PACKET*sizeof(spectate::block_update));
+    uint32_t last_tick = 0;
+    uint32_t updated = 0;
+    ssize_t size;
+    while ((size = recv(fd, buffer.data(), buffer.size(), 0)) > 0) {
+        spectate::packet_header header;
+        if ((size_t)size < sizeof(header)) {
+            fprintf(stderr, "Packet too short\n");
+            break;
+        }
+        memcpy(&header, buffer.data(), sizeof(header));
+        if ((size_t)size != sizeof(header) + header.updates*sizeof(spectate::block_update)) {
+            fprintf(stderr, "Packet has wrong size\n");
+            break;
+        }
+        if (header.flags & spectate::FIRST_PACKET) {
+            if (last_tick && header.tick != last_tick + 1) {
+                printf("dropped %u ticks\n", header.tick - last_tick - 1);
+            }
+            mirror.resize(header.blocks);
+            updated = 0;
+        }
+        const spectate::block_update * updates = (const spectate::block_update*)(buffer.data() + sizeof(header));
+        for (uint32_t i=0; i<header.updates; i++) {
+            if (updates[i].index < mirror.size()) mirror[updates[i].index] = updates[i];
+        }
+        updated += header.updates;
+        if (header.flags & spectate::LAST_PACKET) {
+            printf("tick %u%s: player at (%.3f, %.3f, %.3f) move %u, %u of %u blocks updated\n", 
+                header.tick, (header.flags & spectate::KEYFRAME)?" (keyframe)":"",
+                header.position[0], header.position[1], header.position[2], header.move_counter, 
+                updated, header.blocks);
+            last_tick = header.tick;
+        }
+    }
+    close(fd);
+    return 0;
+}
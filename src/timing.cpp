@@ -16,10 +16,17 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
 #include "timing.h"
 
 #define USE_QFPC // escape to use old counter
 
+// Time before a deadline at which sleep_until stops sleeping and starts spinning, in milliseconds.
+// This covers the time the scheduler takes to wake up the thread.
+static const double SPIN_TIME = 1.0;
+
 #if defined _WIN32 || defined _WIN64
 #ifdef USE_QFPC
 // High resolution windows timer
@@ -41,8 +48,16 @@ Timer::Timer() : data(new TimerData())
 
 double Timer::elapsed()
 {
-	QueryPerformanceCounter(&data->end);
-	return (data->end.QuadPart - data->begin.QuadPart)*1000./(double)data->freq.QuadPart;
+	LARGE_INTEGER end;
+	QueryPerformanceCounter(&end);
+	return (end.QuadPart - data->begin.QuadPart)*1000./(double)data->freq.QuadPart;
+}
+
+void Timer::sleep_until(double deadline)
+{
+	double remaining = deadline - elapsed();
+	if (remaining > SPIN_TIME) Sleep((DWORD)(remaining - SPIN_TIME));
+	while (elapsed() < deadline) {}
 }
 
 #else
@@ -65,9 +80,10 @@ double Timing::elapsed()
 #ifdef USE_QFPC
 // High resolution linux timer
 #include <time.h>
+#include <errno.h>
 
 struct TimerData {
-    timespec begin, end, freq;
+    timespec begin, freq;
 };
 
 Timer::Timer() : data(new TimerData())
@@ -79,8 +95,25 @@ Timer::Timer() : data(new TimerData())
 
 double Timer::elapsed()
 {
-	clock_gettime(CLOCK_MONOTONIC, &data->end);
-	return (data->end.tv_sec-data->begin.tv_sec)*1000.0 + (data->end.tv_nsec-data->begin.tv_nsec)/1000000.0;
+	timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec-data->begin.tv_sec)*1000.0 + (end.tv_nsec-data->begin.tv_nsec)/1000000.0;
+}
+
+void Timer::sleep_until(double deadline)
+{
+	double wake = deadline - SPIN_TIME;
+	if (wake > elapsed()) {
+		timespec t = data->begin;
+		t.tv_sec += (time_t)(wake / 1000);
+		t.tv_nsec += (long)(fmod(wake, 1000) * 1000000);
+		if (t.tv_nsec >= 1000000000) {
+			t.tv_sec++;
+			t.tv_nsec -= 1000000000;
+		}
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR) {}
+	}
+	while (elapsed() < deadline) {}
 }
 #else
 // Low resolution linux timer
@@ -104,3 +137,35 @@ Timer::~Timer() {
     delete data;
 }
 
+void SampleStats::add(double sample) {
+    count++;
+    sum += sample;
+    sum_squares += sample*sample;
+    if (sample > max) max = sample;
+}
+
+void SampleStats::report() {
+    if (count > 0) {
+        double mean = sum / count;
+        double variance = std::max(0.0, sum_squares / count - mean*mean);
+        fprintf(stderr, "%s: %5.2lf ms mean, %5.2lf ms stddev, %6.2lf ms max over %u samples\n", 
+            name, mean, sqrt(variance), max, count);
+    }
+    count = 0;
+    sum = sum_squares = max = 0;
+}
+
+ThreadTiming::ThreadTiming(const char * name) : name(name), count(0), busy(0) {}
+
+void ThreadTiming::add(double duration) {
+    count++;
+    busy += (unsigned long long)(duration*1000);
+}
+
+void ThreadTiming::report(double period) {
+    unsigned long long n = count.exchange(0);
+    double ms = busy.exchange(0) / 1000.0;
+    fprintf(stderr, "%s: %5.1lf per second, %6.2lf ms each, %5.1lf%% busy\n", 
+        name, n*1000/period, n?ms/n:0, ms*100/period);
+}
+
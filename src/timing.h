@@ -18,6 +18,7 @@
 
 #ifndef TIMING_H
 #define TIMING_H
+#include <atomic>
 
 struct TimerData;
 struct Timer {
@@ -25,11 +26,41 @@ struct Timer {
     Timer();
     ~Timer();
     
-    /** Return time elapsed since last reset in millseconds. */
+    /** Return time elapsed since last reset in millseconds. Can be called from multiple threads. */
     double elapsed();
+    /** 
+     * Waits until elapsed() reaches the deadline. Sleeps until shortly before the 
+     * deadline and spins for the remaining time, as waking up from sleep is imprecise.
+     */
+    void sleep_until(double deadline);
 private:
     Timer(const Timer&);
     TimerData * data;
 };
 
+/** Keeps the mean, variance and maximum of samples, such as frame times, for one thread. */
+struct SampleStats {
+    SampleStats(const char * name) : name(name), count(0), sum(0), sum_squares(0), max(0) {}
+    void add(double sample);
+    /** Prints the statistics of the samples since the previous report. */
+    void report();
+private:
+    const char * name;
+    unsigned int count;
+    double sum, sum_squares, max;
+};
+
+/** Accumulates the time a thread spends working, such that it can be reported by another thread. */
+struct ThreadTiming {
+    ThreadTiming(const char * name);
+    /** Adds the duration of one unit of work in milliseconds. */
+    void add(double duration);
+    /** Prints the work done since the previous report, which was period milliseconds ago. */
+    void report(double period);
+private:
+    const char * name;
+    std::atomic<unsigned long long> count;
+    std::atomic<unsigned long long> busy; // in microseconds
+};
+
 #endif // TIMING_H
@@ -0,0 +1,50 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+#include <atomic>
+
+/**
+ * Hands frames from one writing thread to one reading thread without locking.
+ * This only manages which of the three slots each thread uses, the slots themselves 
+ * are arrays of size 3 owned by the user.
+ * The writer fills write_index() and calls publish(). The reader calls acquire() 
+ * to obtain the most recently published slot, which stays at read_index() until the next acquire().
+ */
+class triple_buffer {
+    static const unsigned int FRESH = 4;
+    std::atomic<unsigned int> middle;
+    unsigned int back;
+    unsigned int front;
+public:
+    triple_buffer() : middle(0), back(1), front(2) {}
+    unsigned int write_index() const { return back; }
+    unsigned int read_index() const { return front; }
+    void publish() {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+    }
+    /** Returns true if a new frame was published since the last call. */
+    bool acquire() {
+        if (!(middle.load(std::memory_order_acquire) & FRESH)) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,207 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <physfs.h>
+#include "../scene.h"
+#include "../events.h"
+#include "../timing.h"
+
+// Maximum distance between a submitted and a replayed position.
+static const double TOLERANCE = 1e-3;
+// Number of interpolated positions that finish() appends to a record.
+static const int RECORD_TAIL = 8;
+
+enum run_status {
+    VERIFIED, 
+    INVALID_RUN,
+    LOAD_FAILED,
+    GEM_NOT_REACHED,
+    TRAJECTORY_MISMATCH,
+};
+
+static const char * status_names[] = {
+    "verified", 
+    "invalid record or input log",
+    "map failed to load",
+    "gem not reached",
+    "trajectory does not match",
+};
+
+// Result of a single run, as sent from a worker process.
+struct run_result {
+    int run;
+    int status;
+    int claimed_move;
+    int replayed_move;
+    double error;
+};
+
+static bool recorded;
+static std::vector<point3f> replayed;
+
+static void capture_record(const std::vector<point3f> & record) {
+    recorded = true;
+    replayed = record;
+}
+
+static bool read_record(const char * filename, std::vector<point3f> & record) {
+    FILE * f = fopen(filename, "rb");
+    if (!f) {
+        perror(filename);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f) / sizeof(point3f);
+    fseek(f, 0, SEEK_SET);
+    record.resize(length);
+    bool ok = fread(record.data(), sizeof(point3f), length, f) == (size_t)length;
+    fclose(f);
+    return ok && length >= RECORD_TAIL;
+}
+
+// Replays the input log of a run and compares the resulting record with the submitted one.
+static run_result verify(const char * record_file) {
+    run_result r = run_result();
+    std::vector<point3f> record;
+    std::vector<logged_input> inputs;
+    char log_file[1024];
+    char map_file[256];
+    snprintf(log_file, 1024, "%s.inputs", record_file);
+    if (!read_record(record_file, record) || !read_input_log(log_file, map_file, 256, inputs)) {
+        r.status = INVALID_RUN;
+        return r;
+    }
+    r.claimed_move = record.size() - RECORD_TAIL;
+    if (!scene::load(map_file)) {
+        r.status = LOAD_FAILED;
+        return r;
+    }
+    
+    // Same order as the game: the gem is taken in scene::interact, after the last logged step.
+    recorded = false;
+    for (uint i=0; i<=inputs.size(); i++) {
+        begin_step();
+        scene::interact();
+        if (recorded || i == inputs.size()) break;
+        replay_input(inputs[i]);
+        move_player();
+    }
+    scene::unload();
+    
+    if (!recorded) {
+        r.status = GEM_NOT_REACHED;
+        return r;
+    }
+    r.replayed_move = replayed.size() - RECORD_TAIL;
+    if (replayed.size() != record.size()) {
+        r.status = TRAJECTORY_MISMATCH;
+        return r;
+    }
+    for (uint i=0; i<record.size(); i++) {
+        glm::dvec3 d(record[i].x - replayed[i].x, record[i].y - replayed[i].y, record[i].z - replayed[i].z);
+        r.error = std::max(r.error, glm::length(d));
+    }
+    r.status = r.error <= TOLERANCE ? VERIFIED : TRAJECTORY_MISMATCH;
+    return r;
+}
+
+// Verifies every workers'th run, starting at the given one, and writes the results to fd.
+static void work(const char * argv0, const char * data_dir, const char ** runs, int count, int worker, int workers, int fd) {
+    PHYSFS_init(argv0);
+    PHYSFS_mount(data_dir, "/", 1);
+    record_hook = capture_record;
+    for (int i=worker; i<count; i+=workers) {
+        run_result r = verify(runs[i]);
+        r.run = i;
+        if (write(fd, &r, sizeof(r)) != sizeof(r)) {
+            perror("Failed to report result");
+        }
+    }
+    PHYSFS_deinit();
+}
+
+/**
+ * Verifies submitted runs by replaying their input logs. 
+ * The engine keeps a single scene per process, hence the runs are spread over worker processes.
+ */
+int main(int argc, const char ** argv) {
+    const char * data_dir = access("maps", R_OK | X_OK) == 0 ? "." : "..";
+    int workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int first = 1;
+    while (first < argc && argv[first][0] == '-') {
+        if (strcmp(argv[first], "-j")==0 && first+1 < argc) {
+            workers = atoi(argv[first+1]);
+            first += 2;
+        } else if (strcmp(argv[first], "--data")==0 && first+1 < argc) {
+            data_dir = argv[first+1];
+            first += 2;
+        } else {
+            break;
+        }
+    }
+    const char ** runs = argv + first;
+    int count = argc - first;
+    if (count <= 0 || workers <= 0) {
+        printf("Usage: %s [-j workers] [--data directory] record...\n", argv[0]);
+        printf("Each record needs its input log, which is stored as <record>.inputs.\n");
+        return 1;
+    }
+    workers = std::min(workers, count);
+    
+    Timer t;
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("Failed to create pipe");
+        return 1;
+    }
+    for (int w=0; w<workers; w++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("Failed to start worker");
+            return 1;
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            work(argv[0], data_dir, runs, count, w, workers, fds[1]);
+            _exit(0);
+        }
+    }
+    close(fds[1]);
+    
+    std::vector<run_result> results(count);
+    std::vector<bool> done(count);
+    run_result r;
+    while (read(fds[0], &r, sizeof(r)) == sizeof(r)) {
+        if (r.run >= 0 && r.run < count) {
+            results[r.run] = r;
+            done[r.run] = true;
+        }
+    }
+    close(fds[0]);
+    while (wait(NULL) > 0) {}
+    double ms = t.elapsed();
+    
+    int verified = 0;
+    for (int i=0; i<count; i++) {
+        const run_result & r = results[i];
+        if (!done[i]) {
+            printf("%s: worker failed\n", runs[i]);
+        } else if (r.status == VERIFIED) {
+            printf("%s: verified, gem reached at move %d\n", runs[i], r.replayed_move);
+            verified++;
+        } else if (r.status == TRAJECTORY_MISMATCH) {
+            printf("%s: %s, claimed move %d, replayed move %d, error %.6lf\n", 
+                runs[i], status_names[r.status], r.claimed_move, r.replayed_move, r.error);
+        } else {
+            printf("%s: %s\n", runs[i], status_names[r.status]);
+        }
+    }
+    printf("%d of %d runs verified in %.1lf ms with %d workers, %.1lf runs/s\n", 
+        verified, count, ms, workers, count * 1000 / ms);
+    return verified == count ? 0 : 2;
+}
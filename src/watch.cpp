@@ -0,0 +1,106 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <physfs.h>
+
+#include "watch.h"
+
+static std::thread watcher;
+static std::atomic<bool> modified(false);
+static int inotify_fd = -1;
+static int stop_pipe[2] = {-1, -1};
+static char watched_name[256];
+
+static void watch_loop() {
+    // Align the buffer, as inotify_event contains an int.
+    char buffer[4096] __attribute__((aligned(__alignof__(inotify_event))));
+    pollfd fds[2] = {
+        {inotify_fd, POLLIN, 0},
+        {stop_pipe[0], POLLIN, 0},
+    };
+    while (poll(fds, 2, -1) >= 0 && !(fds[1].revents & POLLIN)) {
+        if (!(fds[0].revents & POLLIN)) continue;
+        ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+        if (len <= 0) break;
+        for (char * p = buffer; p < buffer + len; ) {
+            const inotify_event * e = (const inotify_event *)p;
+            // Editors often save by writing a new file and renaming it.
+            if (e->len && strcmp(e->name, watched_name) == 0) {
+                modified = true;
+            }
+            p += sizeof(inotify_event) + e->len;
+        }
+    }
+}
+
+bool watch::start(const char* physfs_filename) {
+    stop();
+    const char * dir = PHYSFS_getRealDir(physfs_filename);
+    if (!dir) return false;
+    
+    // Split the real path into the directory to watch and the file name to look for.
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, physfs_filename);
+    char * slash = strrchr(path, '/');
+    *slash = 0;
+    strncpy(watched_name, slash+1, sizeof(watched_name)-1);
+    
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        perror("Failed to initialize inotify");
+        return false;
+    }
+    if (inotify_add_watch(inotify_fd, path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) == -1) {
+        fprintf(stderr, "Failed to watch '%s': %s\n", path, strerror(errno));
+        close(inotify_fd);
+        inotify_fd = -1;
+        return false;
+    }
+    if (pipe(stop_pipe) == -1) {
+        perror("Failed to create pipe");
+        close(inotify_fd);
+        inotify_fd = -1;
+        return false;
+    }
+    modified = false;
+    watcher = std::thread(watch_loop);
+    return true;
+}
+
+void watch::stop() {
+    if (!watcher.joinable()) return;
+    char c = 0;
+    if (write(stop_pipe[1], &c, 1) != 1) perror("Failed to stop watcher");
+    watcher.join();
+    close(stop_pipe[0]);
+    close(stop_pipe[1]);
+    close(inotify_fd);
+    inotify_fd = -1;
+}
+
+bool watch::changed() {
+    return modified.exchange(false);
+}
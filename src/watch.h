@@ -0,0 +1,34 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef WATCH_H
+#define WATCH_H
+
+/**
+ * Watches a single file for modifications on a background thread.
+ * The main loop polls changed(), which does not touch the filesystem.
+ */
+namespace watch {
+    /** Starts watching the given physfs file, replacing any previous watch. */
+    bool start(const char * physfs_filename);
+    void stop();
+    /** Returns whether the file was modified since the last call. */
+    bool changed();
+};
+
+#endif
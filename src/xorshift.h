@@ -0,0 +1,44 @@
+/*
+    Block Game - A minimalistic 3D platform game
+    Copyright (C) 2014  B.J. Conijn <bcmpinc@users.sourceforge.net>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef XORSHIFT_H
+#define XORSHIFT_H
+
+#include <cstdint>
+
+/** 
+ * Small and fast pseudo random generator. Unlike rand() it does not depend on the C library
+ * or on shared state, such that the same seed always gives the same numbers.
+ */
+struct xorshift {
+    uint32_t state;
+    xorshift(uint32_t seed) : state(seed ? seed : 1) {}
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    /** Returns a number in [low, high). */
+    double uniform(double low, double high) {
+        return low + (high - low) * (next() / 4294967296.0);
+    }
+};
+
+#endif